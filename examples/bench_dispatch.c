@@ -0,0 +1,108 @@
+#include <neutron.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <log.h>
+
+#define BENCH_SPINS 100000
+
+static const int counts[] = {10, 100, 1000, 10000, 100000};
+
+static uint64_t hits;
+
+static struct neutron_loop_options options;
+
+static void callback(int fd, uint32_t revents, void *userdata)
+{
+	/* the eventfd is never read so that it stays readable */
+	hits++;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench(int count)
+{
+	int ret = 0;
+	int *fds = calloc(count, sizeof(int));
+	struct neutron_loop *loop = neutron_loop_create_with_options(&options);
+
+	if (!fds || !loop) {
+		LOGE("Failed to allocate benchmark resources");
+		free(fds);
+		return ENOMEM;
+	}
+
+	for (int i = 0; i < count; i++) {
+		fds[i] = eventfd(0, EFD_NONBLOCK);
+		if (fds[i] < 0) {
+			ret = errno;
+			LOG_ERRNO("eventfd");
+			count = i;
+			goto out;
+		}
+
+		ret = neutron_loop_add(
+			loop, fds[i], callback, NEUTRON_FD_EVENT_IN, NULL);
+		if (ret)
+			goto out;
+	}
+
+	/* only the last registered fd is ready: worst case for a list walk */
+	uint64_t value = 1;
+	write(fds[count - 1], &value, sizeof(value));
+
+	hits = 0;
+	uint64_t start = now_ns();
+	for (int i = 0; i < BENCH_SPINS; i++)
+		neutron_loop_spin(loop);
+	uint64_t elapsed = now_ns() - start;
+
+	LOGI("fds: %6d  dispatches: %lu  ns/dispatch: %lu",
+	     count,
+	     hits,
+	     elapsed / BENCH_SPINS);
+
+out:
+	for (int i = 0; i < count; i++) {
+		neutron_loop_remove(loop, fds[i]);
+		close(fds[i]);
+	}
+	neutron_loop_destroy(loop);
+	free(fds);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rlimit rl;
+
+	/* -u: run on the io_uring backend */
+	if (argc > 1 && strcmp(argv[1], "-u") == 0)
+		options.backend = NEUTRON_LOOP_BACKEND_IO_URING;
+
+	/* raise the fd limit as far as we are allowed to */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		if ((rlim_t)counts[i] + 16 > rl.rlim_cur) {
+			LOGW("Skipping %d fds: RLIMIT_NOFILE is %lu",
+			     counts[i],
+			     (unsigned long)rl.rlim_cur);
+			continue;
+		}
+
+		if (bench(counts[i]))
+			return EXIT_FAILURE;
+	}
+
+	return 0;
+}
@@ -0,0 +1,196 @@
+#include <neutron.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <log.h>
+
+#define BENCH_UPDATES 1000
+#define BENCH_BURST 50
+
+static const int counts[] = {10, 100, 1000, 5000};
+static const size_t sizes[] = {256, 4096};
+
+static struct neutron_loop *loop;
+static int connected;
+static uint64_t received;
+static uint64_t failures;
+
+static uint8_t rxbuf[64 * 1024];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void rx_cb(int fd, uint32_t revents, void *userdata)
+{
+	ssize_t len;
+
+	while ((len = read(fd, rxbuf, sizeof(rxbuf))) > 0)
+		received += len;
+}
+
+static void event_cb(struct neutron_ctx *ctx,
+		     enum neutron_event event,
+		     struct neutron_conn *conn,
+		     void *userdata)
+{
+	if (event == NEUTRON_EVENT_CONNECTED)
+		connected++;
+}
+
+static void error_cb(struct neutron_ctx *ctx,
+		     struct neutron_conn *conn,
+		     int error,
+		     void *userdata)
+{
+	failures++;
+}
+
+static int bench(int count, size_t size, int shared)
+{
+	int ret = 0;
+	int *fds = calloc(count, sizeof(int));
+	uint8_t *update = calloc(1, size);
+	struct neutron_ctx *ctx =
+		neutron_ctx_create_with_loop(event_cb, loop, NULL);
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	char address[64];
+	/* below the ephemeral range used by the subscribers */
+	static int port = 31000;
+
+	if (!fds || !update || !ctx) {
+		LOGE("Failed to allocate benchmark resources");
+		ret = ENOMEM;
+		goto out;
+	}
+
+	sin.sin_port = htons(++port);
+	snprintf(address, sizeof(address), "inet:127.0.0.1:%d", port);
+	struct neutron_addr *addr = neutron_addr_parse(address);
+	ret = neutron_ctx_listen(ctx, addr);
+	if (ret)
+		goto out;
+
+	/* the subscribers read in large chunks so that the publisher is
+	 * measured */
+	connected = 0;
+	for (int i = 0; i < count; i++) {
+		fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fds[i] < 0
+		    || connect(fds[i], (struct sockaddr *)&sin, sizeof(sin))
+			       < 0
+		    || fcntl(fds[i], F_SETFL, O_NONBLOCK) < 0) {
+			ret = errno;
+			LOG_ERRNO("Failed to connect subscriber");
+			count = i + 1;
+			goto out;
+		}
+
+		ret = neutron_loop_add(
+			loop, fds[i], rx_cb, NEUTRON_FD_EVENT_IN, NULL);
+		if (ret)
+			goto out;
+
+		/* keep the accept queue short */
+		while (connected <= i)
+			neutron_loop_spin(loop);
+	}
+
+	received = 0;
+	failures = 0;
+	uint64_t expected = 0;
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < BENCH_UPDATES; i++) {
+		if (shared) {
+			struct neutron_buf *buf = neutron_buf_new(update, size);
+			if (!buf) {
+				ret = ENOMEM;
+				goto out;
+			}
+			neutron_ctx_send_buf(ctx, buf, error_cb);
+			neutron_buf_unref(buf);
+		} else {
+			neutron_ctx_send(ctx, update, size);
+		}
+		expected += (uint64_t)size * count;
+
+		/* let the subscribers catch up after each burst */
+		if ((i + 1) % BENCH_BURST == 0) {
+			while (received < expected)
+				neutron_loop_spin(loop);
+		}
+	}
+
+	while (received < expected)
+		neutron_loop_spin(loop);
+	uint64_t elapsed = now_ns() - start;
+
+	LOGI("%-6s subscribers: %5d  size: %5zu  deliveries/s: %9lu  "
+	     "ns/update: %8lu  failures: %lu",
+	     shared ? "shared" : "copy",
+	     count,
+	     size,
+	     (unsigned long)((uint64_t)BENCH_UPDATES * count * 1000000000ULL
+			     / elapsed),
+	     (unsigned long)(elapsed / BENCH_UPDATES),
+	     (unsigned long)failures);
+
+out:
+	for (int i = 0; fds && i < count; i++) {
+		if (fds[i] <= 0)
+			continue;
+		neutron_loop_remove(loop, fds[i]);
+		close(fds[i]);
+	}
+	if (ctx) {
+		neutron_ctx_disconnect(ctx);
+		neutron_ctx_destroy(ctx);
+	}
+	free(update);
+	free(fds);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct rlimit rl;
+
+	/* raise the fd limit as far as we are allowed to */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	loop = neutron_loop_create();
+	if (!loop)
+		return EXIT_FAILURE;
+
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		/* a subscriber costs two fds */
+		if ((rlim_t)counts[i] * 2 + 16 > rl.rlim_cur) {
+			LOGW("Skipping %d subscribers: RLIMIT_NOFILE is %lu",
+			     counts[i],
+			     (unsigned long)rl.rlim_cur);
+			continue;
+		}
+
+		for (size_t j = 0; j < sizeof(sizes) / sizeof(sizes[0]);
+		     j++) {
+			if (bench(counts[i], sizes[j], 0)
+			    || bench(counts[i], sizes[j], 1))
+				return EXIT_FAILURE;
+		}
+	}
+
+	neutron_loop_destroy(loop);
+	return 0;
+}
@@ -0,0 +1,280 @@
+#include <neutron.h>
+#include <time.h>
+#include <log.h>
+
+#define BENCH_PACKETS 200000
+#define BENCH_BURST 32
+#define BENCH_PORT 32000
+
+static const size_t sizes[] = {64, 512, 1400};
+
+static struct neutron_loop *loop;
+static uint64_t received;
+static int stalled;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void data_cb(struct neutron_ctx *ctx,
+		    struct neutron_conn *conn,
+		    uint8_t *buf,
+		    uint32_t buflen,
+		    void *userdata)
+{
+	received++;
+}
+
+static void batch_cb(struct neutron_ctx *ctx,
+		     struct neutron_conn *conn,
+		     struct neutron_dgram *dgrams,
+		     uint32_t count,
+		     void *userdata)
+{
+	received += count;
+}
+
+/* datagrams dropped on the way never show up, give up once the count has
+ * not moved for a tick */
+static void watchdog_cb(struct neutron_timer *timer, void *userdata)
+{
+	static uint64_t last;
+
+	if (received == last)
+		stalled = 1;
+	last = received;
+}
+
+static int wait_for(uint64_t count)
+{
+	stalled = 0;
+	while (received < count && !stalled)
+		neutron_loop_spin(loop);
+	return received >= count;
+}
+
+static int send_one(struct neutron_ctx *tx, struct neutron_addr *group)
+{
+	uint8_t payload[8] = {0};
+	return neutron_ctx_send_to(tx, group, payload, sizeof(payload));
+}
+
+/* loopback delivery of any-source and source-specific memberships */
+static int check(struct neutron_ctx *rx,
+		 struct neutron_ctx *tx,
+		 const char *family,
+		 const char *group_str,
+		 const char *source_str,
+		 const char *other_str)
+{
+	struct neutron_addr *group = neutron_addr_parse(group_str);
+	struct neutron_addr *source = neutron_addr_parse(source_str);
+	struct neutron_addr *other = neutron_addr_parse(other_str);
+	int ret = 0, ok;
+
+	if (!group || !source || !other) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	ret = neutron_ctx_join_group(rx, group, NULL, "lo");
+	if (ret)
+		goto out;
+	received = 0;
+	ret = send_one(tx, group);
+	ok = !ret && wait_for(1);
+	LOGI("%s any-source join: %s", family, ok ? "ok" : "FAILED");
+	neutron_ctx_leave_group(rx, group, NULL, "lo");
+	if (!ok)
+		goto fail;
+
+	ret = neutron_ctx_join_group(rx, group, source, "lo");
+	if (ret)
+		goto out;
+	received = 0;
+	ret = send_one(tx, group);
+	ok = !ret && wait_for(1);
+	LOGI("%s source join, matching source: %s",
+	     family,
+	     ok ? "ok" : "FAILED");
+	neutron_ctx_leave_group(rx, group, source, "lo");
+	if (!ok)
+		goto fail;
+
+	ret = neutron_ctx_join_group(rx, group, other, "lo");
+	if (ret)
+		goto out;
+	received = 0;
+	ret = send_one(tx, group);
+	ok = !ret && !wait_for(1);
+	LOGI("%s source join, other source: %s",
+	     family,
+	     ok ? "filtered" : "FAILED");
+	neutron_ctx_leave_group(rx, group, other, "lo");
+	if (!ok)
+		goto fail;
+
+	goto out;
+
+fail:
+	ret = ret ? ret : EPROTO;
+out:
+	free(group);
+	free(source);
+	free(other);
+	return ret;
+}
+
+static int bench(struct neutron_ctx *rx,
+		 struct neutron_ctx *tx,
+		 struct neutron_addr *group,
+		 size_t size,
+		 int batch)
+{
+	struct neutron_dgram dgrams[BENCH_BURST];
+	uint8_t *payload = calloc(1, size);
+	uint64_t sent = 0;
+	int ret = 0;
+
+	if (!payload)
+		return ENOMEM;
+
+	for (int i = 0; i < BENCH_BURST; i++) {
+		dgrams[i].buf = payload;
+		dgrams[i].len = size;
+		dgrams[i].addr = group;
+	}
+
+	neutron_ctx_set_dgram_batch(rx, batch ? BENCH_BURST : 1, batch_cb);
+	received = 0;
+
+	uint64_t start = now_ns();
+	while (sent < BENCH_PACKETS) {
+		if (batch) {
+			uint32_t count = 0;
+			ret = neutron_ctx_send_to_batch(
+				tx, dgrams, BENCH_BURST, &count);
+			sent += count;
+		} else {
+			for (int i = 0; i < BENCH_BURST && !ret; i++, sent++)
+				ret = neutron_ctx_send_to(tx, group, payload, size);
+		}
+		if (ret)
+			goto out;
+
+		/* the receive queue drops what it cannot hold */
+		if (!wait_for(sent))
+			break;
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	LOGI("%-8s size: %5zu  pps: %9lu  ns/packet: %6lu  lost: %lu",
+	     batch ? "recvmmsg" : "recvfrom",
+	     size,
+	     (unsigned long)(received * 1000000000ULL / elapsed),
+	     (unsigned long)(elapsed / (received ? received : 1)),
+	     (unsigned long)(sent - received));
+
+out:
+	free(payload);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = EXIT_FAILURE;
+	struct neutron_ctx *rx = NULL, *tx = NULL, *rx6 = NULL, *tx6 = NULL;
+	struct neutron_timer *watchdog = NULL;
+	struct neutron_addr *group = NULL;
+	char address[64];
+
+	loop = neutron_loop_create();
+	if (!loop)
+		return EXIT_FAILURE;
+
+	watchdog = neutron_timer_create_with_loop(loop, watchdog_cb, NULL);
+	rx = neutron_ctx_create_with_loop(NULL, loop, NULL);
+	tx = neutron_ctx_create_with_loop(NULL, loop, NULL);
+	group = neutron_addr_parse("inet:239.255.0.1:0");
+	if (!watchdog || !rx || !tx || !group)
+		goto out;
+
+	neutron_timer_set_periodic(watchdog, 500, 500);
+
+	/* the sender loops its datagrams back over lo, larger datagrams than
+	 * the read buffer would be dropped */
+	neutron_ctx_set_socket_data_cb(rx, data_cb);
+	neutron_ctx_set_read_buffer(rx, 2048, 2048);
+	snprintf(address, sizeof(address), "inet:0.0.0.0:%d", BENCH_PORT);
+	if (neutron_ctx_bind(rx, neutron_addr_parse(address))
+	    || neutron_ctx_set_multicast(tx, 1, 1, "lo")
+	    || neutron_ctx_bind(tx, neutron_addr_parse("inet:127.0.0.1:0")))
+		goto out;
+
+	snprintf(address, sizeof(address), "inet:239.255.0.1:%d", BENCH_PORT);
+	if (check(rx, tx, "IPv4", address, "inet:127.0.0.1:0", "inet:10.0.0.1:0"))
+		goto out;
+
+	/* IPv6 multicast needs the multicast flag on lo */
+	rx6 = neutron_ctx_create_with_loop(NULL, loop, NULL);
+	tx6 = neutron_ctx_create_with_loop(NULL, loop, NULL);
+	if (!rx6 || !tx6)
+		goto out;
+	neutron_ctx_set_socket_data_cb(rx6, data_cb);
+	snprintf(address, sizeof(address), "inet6:[::]:%d", BENCH_PORT);
+	if (neutron_ctx_bind(rx6, neutron_addr_parse(address))
+	    || neutron_ctx_set_multicast(tx6, 1, 1, "lo")
+	    || neutron_ctx_bind(tx6, neutron_addr_parse("inet6:[::1]:0"))) {
+		LOGW("Skipping IPv6 checks: no IPv6 on lo");
+	} else {
+		snprintf(address,
+			 sizeof(address),
+			 "inet6:[ff15::1]:%d",
+			 BENCH_PORT);
+		if (check(rx6,
+			  tx6,
+			  "IPv6",
+			  address,
+			  "inet6:[::1]:0",
+			  "inet6:[fd00::1]:0"))
+			LOGW("IPv6 multicast is not usable on lo");
+	}
+
+	free(group);
+	snprintf(address, sizeof(address), "inet:239.255.0.1:%d", BENCH_PORT);
+	group = neutron_addr_parse(address);
+	if (!group || neutron_ctx_join_group(rx, group, NULL, "lo"))
+		goto out;
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench(rx, tx, group, sizes[i], 0)
+		    || bench(rx, tx, group, sizes[i], 1))
+			goto out;
+	}
+	ret = 0;
+
+out:
+	if (rx6) {
+		neutron_ctx_disconnect(rx6);
+		neutron_ctx_destroy(rx6);
+	}
+	if (tx6) {
+		neutron_ctx_disconnect(tx6);
+		neutron_ctx_destroy(tx6);
+	}
+	if (rx) {
+		neutron_ctx_disconnect(rx);
+		neutron_ctx_destroy(rx);
+	}
+	if (tx) {
+		neutron_ctx_disconnect(tx);
+		neutron_ctx_destroy(tx);
+	}
+	neutron_timer_destroy(watchdog);
+	free(group);
+	neutron_loop_destroy(loop);
+	return ret;
+}
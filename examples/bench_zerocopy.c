@@ -0,0 +1,205 @@
+#include <neutron.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <time.h>
+#include <unistd.h>
+#include <log.h>
+
+#define BENCH_BYTES (1024UL * 1024 * 1024)
+#define BENCH_BUFS 16
+
+static const size_t sizes[] = {4096, 16384, 65536, 262144, 1048576};
+
+static struct neutron_loop *loop;
+static struct neutron_conn *client;
+static int connected;
+
+static uint8_t rxbuf[1024 * 1024];
+static uint64_t received;
+
+/* a slot may only be rewritten once its zero-copy send was released */
+static uint8_t *bufs[BENCH_BUFS];
+static int busy[BENCH_BUFS];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void rx_cb(int fd, uint32_t revents, void *userdata)
+{
+	ssize_t len;
+
+	while ((len = read(fd, rxbuf, sizeof(rxbuf))) > 0)
+		received += len;
+}
+
+static void event_cb(struct neutron_ctx *ctx,
+		     enum neutron_event event,
+		     struct neutron_conn *conn,
+		     void *userdata)
+{
+	if (event == NEUTRON_EVENT_CONNECTED) {
+		client = conn;
+		connected = 1;
+	} else if (event == NEUTRON_EVENT_CONNECT_FAILED) {
+		connected = -1;
+	}
+}
+
+static void release_cb(struct neutron_ctx *ctx,
+		       const uint8_t *buf,
+		       void *cookie,
+		       void *userdata)
+{
+	busy[(uintptr_t)cookie] = 0;
+}
+
+static int bench(size_t size, int zerocopy)
+{
+	int ret = 0, lfd = -1, rfd = -1;
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t sinlen = sizeof(sin);
+	struct neutron_ctx *ctx = NULL;
+	struct neutron_addr *addr = NULL;
+	char address[64];
+
+	/* the receiver reads in large chunks so that the sender is measured */
+	lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&sin, sinlen) < 0
+	    || listen(lfd, 1) < 0
+	    || getsockname(lfd, (struct sockaddr *)&sin, &sinlen) < 0) {
+		ret = errno;
+		LOG_ERRNO("Failed to set up the receiver");
+		goto out;
+	}
+
+	snprintf(address,
+		 sizeof(address),
+		 "inet:127.0.0.1:%d",
+		 ntohs(sin.sin_port));
+	addr = neutron_addr_parse(address);
+	ctx = neutron_ctx_create_with_loop(event_cb, loop, NULL);
+	if (!addr || !ctx) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	if (zerocopy)
+		neutron_ctx_set_zerocopy(ctx, release_cb);
+
+	connected = 0;
+	ret = neutron_ctx_connect_async(ctx, addr, 1000);
+	if (ret)
+		goto out;
+
+	rfd = accept(lfd, NULL, NULL);
+	if (rfd < 0 || fcntl(rfd, F_SETFL, O_NONBLOCK) < 0) {
+		ret = errno;
+		LOG_ERRNO("Failed to accept the sender");
+		goto out;
+	}
+
+	ret = neutron_loop_add(loop, rfd, rx_cb, NEUTRON_FD_EVENT_IN, NULL);
+	if (ret)
+		goto out;
+
+	while (!connected)
+		neutron_loop_spin(loop);
+	if (connected < 0) {
+		ret = ECONNREFUSED;
+		goto out;
+	}
+
+	uint64_t count = BENCH_BYTES / size;
+	received = 0;
+
+	uint64_t start = now_ns();
+	for (uint64_t i = 0; i < count; i++) {
+		uintptr_t slot = i % BENCH_BUFS;
+
+		while (busy[slot])
+			neutron_loop_spin(loop);
+
+		if (zerocopy) {
+			busy[slot] = 1;
+			ret = neutron_ctx_send_zerocopy(
+				ctx, bufs[slot], size, (void *)slot);
+		} else {
+			ret = neutron_ctx_send(ctx, bufs[slot], size);
+		}
+		if (ret)
+			goto out;
+
+		/* do not let the write queue grow without bounds */
+		while (neutron_conn_get_write_pending(client) > 0)
+			neutron_loop_spin(loop);
+	}
+
+	while (received < count * size)
+		neutron_loop_spin(loop);
+	uint64_t elapsed = now_ns() - start;
+
+	/* release the last buffers before the slots are reused */
+	for (int i = 0; i < BENCH_BUFS; i++) {
+		while (busy[i])
+			neutron_loop_spin(loop);
+	}
+
+	struct neutron_ctx_zerocopy_stats stats = {0};
+	neutron_ctx_get_zerocopy_stats(ctx, &stats);
+
+	LOGI("%-8s size: %8zu  MiB/s: %6lu  ns/send: %8lu  zc sends: %lu  copied: %lu",
+	     zerocopy ? "zerocopy" : "copy",
+	     size,
+	     (unsigned long)(count * size * 1000000000ULL / elapsed
+			     / (1024 * 1024)),
+	     (unsigned long)(elapsed / count),
+	     (unsigned long)stats.sends,
+	     (unsigned long)stats.copied);
+
+out:
+	if (rfd >= 0) {
+		neutron_loop_remove(loop, rfd);
+		close(rfd);
+	}
+	if (lfd >= 0)
+		close(lfd);
+	if (ctx) {
+		neutron_ctx_disconnect(ctx);
+		neutron_ctx_destroy(ctx);
+	}
+	free(addr);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	loop = neutron_loop_create();
+	if (!loop)
+		return EXIT_FAILURE;
+
+	for (int i = 0; i < BENCH_BUFS; i++) {
+		bufs[i] = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+		if (!bufs[i])
+			return EXIT_FAILURE;
+		memset(bufs[i], i, sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	}
+
+	/* loopback delivers by copying on the receive side, the completions
+	 * then report the sends as copied */
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench(sizes[i], 0) || bench(sizes[i], 1))
+			return EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < BENCH_BUFS; i++)
+		free(bufs[i]);
+	neutron_loop_destroy(loop);
+	return 0;
+}
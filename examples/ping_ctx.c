@@ -26,7 +26,7 @@ void server_data_cb(struct neutron_ctx *ctx,
 		    void *userdata)
 {
 	LOGD("Server Received: %s", (char *)buf);
-	neutron_ctx_send(ctx, (uint8_t *)PONG, strlen(PONG));
+	neutron_conn_send(conn, (uint8_t *)PONG, strlen(PONG));
 }
 
 void client_data_cb(struct neutron_ctx *ctx,
@@ -4,18 +4,21 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 struct neutron_loop;
+struct neutron_loop_group;
 struct neutron_fd;
 struct neutron_evt;
 struct neutron_ctx;
 struct neutron_conn;
 struct neutron_timer;
 struct neutron_addr;
+struct neutron_buf;
 
 enum neutron_fd_event {
 	NEUTRON_FD_EVENT_IN = 0x001,
@@ -23,6 +26,26 @@ enum neutron_fd_event {
 	NEUTRON_FD_EVENT_OUT = 0x004,
 	NEUTRON_FD_EVENT_ERROR = 0x008,
 	NEUTRON_FD_EVENT_HUP = 0x010,
+	/* registration modes, only meaningful for neutron_loop_add/rearm */
+	NEUTRON_FD_EVENT_ET = 0x100,
+	NEUTRON_FD_EVENT_ONESHOT = 0x200,
+};
+
+enum neutron_timer_flags {
+	/* multiplex the timer on the loop timing wheel (1ms resolution)
+	 * instead of giving it its own timerfd */
+	NEUTRON_TIMER_WHEEL = 0x01,
+};
+
+/* what a periodic timer does when several periods passed since its last
+ * callback, e.g. because the loop was stalled */
+enum neutron_timer_overrun_policy {
+	/* one callback reporting every elapsed period (default) */
+	NEUTRON_TIMER_OVERRUN_COALESCE = 0,
+	/* one callback per elapsed period */
+	NEUTRON_TIMER_OVERRUN_CATCH_UP,
+	/* one callback, the missed periods are dropped */
+	NEUTRON_TIMER_OVERRUN_SKIP,
 };
 
 enum neutron_ctx_type {
@@ -35,10 +58,94 @@ enum neutron_event {
 	NEUTRON_EVENT_CONNECTED = 0,
 	NEUTRON_EVENT_DISCONNECTED,
 	NEUTRON_EVENT_DATA,
+	/* an asynchronous connect failed or timed out, the conn is only
+	 * valid during the callback */
+	NEUTRON_EVENT_CONNECT_FAILED,
+	/* the outbound queue of the conn reached the high watermark */
+	NEUTRON_EVENT_WRITE_HIGH_WATERMARK,
+	/* the outbound queue drained back to the low watermark */
+	NEUTRON_EVENT_WRITE_LOW_WATERMARK,
+};
+
+enum neutron_frame_prefix {
+	/* data_cb gets the stream data as it is read */
+	NEUTRON_FRAME_NONE = 0,
+	/* big-endian length of 1, 2, 4 or 8 bytes */
+	NEUTRON_FRAME_FIXED,
+	/* LEB128 varint length, as used by protobuf */
+	NEUTRON_FRAME_VARINT,
+};
+
+enum neutron_loop_backend {
+	NEUTRON_LOOP_BACKEND_EPOLL = 0,
+	/* falls back to epoll when io_uring is not available. Stream
+	 * connections of a ctx on this loop accept, receive and send through
+	 * io_uring completions when the kernel has multishot receive (6.0),
+	 * unframed data_cb calls then get up to 4 KiB each. */
+	NEUTRON_LOOP_BACKEND_IO_URING,
+};
+
+struct neutron_loop_options {
+	/* epoll batch size, 0 for the default */
+	uint32_t max_events;
+	/* upper bound of the batch size in adaptive mode, 0 for the default */
+	uint32_t max_events_limit;
+	/* grow the batch when a wait fills it, shrink it when idle */
+	int adaptive;
+	enum neutron_loop_backend backend;
+};
+
+/* one datagram of a batch */
+struct neutron_dgram {
+	uint8_t *buf;
+	uint32_t len;
+	/* sender on receive, valid during the callback, destination on
+	 * send */
+	struct neutron_addr *addr;
+	/* session conn of the sender on receive when the ctx keeps
+	 * sessions, NULL otherwise. Unused on send. */
+	struct neutron_conn *conn;
+};
+
+/* listener counters, sample them periodically to get accept rates */
+struct neutron_ctx_accept_stats {
+	/* connections accepted */
+	uint64_t accepted;
+	/* accept failures other than an empty queue */
+	uint64_t failed;
+	/* listener wakeups */
+	uint64_t wakeups;
+	/* wakeups that stopped at the accept batch cap with connections
+	 * possibly left in the queue */
+	uint64_t capped;
+};
+
+/* connection pool counters */
+struct neutron_ctx_pool_stats {
+	/* connections taken from the pool */
+	uint64_t hits;
+	/* connections allocated because the pool was empty */
+	uint64_t misses;
+	/* released connections freed because the pool was full */
+	uint64_t dropped;
+	/* connections currently in the pool */
+	uint64_t available;
+};
+
+/* zero-copy send counters */
+struct neutron_ctx_zerocopy_stats {
+	/* MSG_ZEROCOPY sends that took data */
+	uint64_t sends;
+	/* sends the kernel reported done */
+	uint64_t completions;
+	/* completed sends the kernel copied anyway, e.g. over loopback */
+	uint64_t copied;
 };
 
 typedef void (*neutron_fd_event_cb)(int fd, uint32_t revents, void *userdata);
 
+typedef void (*neutron_loop_task_cb)(struct neutron_loop *loop, void *arg);
+
 typedef void (*neutron_ctx_fd_cb)(struct neutron_ctx *ctx,
 				  int fd,
 				  void *userdata);
@@ -54,20 +161,45 @@ typedef void (*neutron_ctx_data_cb)(struct neutron_ctx *ctx,
 				    uint32_t buflen,
 				    void *userdata);
 
+typedef void (*neutron_ctx_dgram_batch_cb)(struct neutron_ctx *ctx,
+					   struct neutron_conn *conn,
+					   struct neutron_dgram *dgrams,
+					   uint32_t count,
+					   void *userdata);
+
+typedef void (*neutron_ctx_zc_release_cb)(struct neutron_ctx *ctx,
+					  const uint8_t *buf,
+					  void *cookie,
+					  void *userdata);
+
+typedef void (*neutron_ctx_send_error_cb)(struct neutron_ctx *ctx,
+					  struct neutron_conn *conn,
+					  int error,
+					  void *userdata);
+
 typedef void (*neutron_evt_cb)(struct neutron_evt *evt, void *userdata);
 
 typedef void (*neutron_timer_cb)(struct neutron_timer *timer, void *userdata);
 
+typedef void (*neutron_timer_overrun_cb)(struct neutron_timer *timer,
+					 uint64_t expirations,
+					 void *userdata);
+
 /* loop public API */
 
 struct neutron_loop *neutron_loop_create();
 
+struct neutron_loop *
+neutron_loop_create_with_options(const struct neutron_loop_options *options);
+
 int neutron_loop_add(struct neutron_loop *loop,
 		     int fd,
 		     neutron_fd_event_cb cb,
 		     uint32_t events,
 		     void *userdata);
 
+int neutron_loop_rearm(struct neutron_loop *loop, int fd, uint32_t events);
+
 int neutron_loop_remove(struct neutron_loop *loop, int fd);
 
 struct neutron_fd *neutron_loop_find_fd(struct neutron_loop *loop, int fd);
@@ -78,9 +210,36 @@ void neutron_loop_destroy(struct neutron_loop *loop);
 
 void neutron_loop_wakeup(struct neutron_loop *loop);
 
+/* Run cb(loop, arg) on the loop thread during a later neutron_loop_spin.
+ * Safe to call from any thread. */
+int neutron_loop_post(struct neutron_loop *loop,
+		      neutron_loop_task_cb cb,
+		      void *arg);
+
 void neutron_loop_display_registered_fds(struct neutron_loop *loop);
 
+enum neutron_loop_backend neutron_loop_get_backend(struct neutron_loop *loop);
+
+/* loop group public API: one loop per thread */
+
+struct neutron_loop_group *
+neutron_loop_group_create(uint32_t count,
+			  const struct neutron_loop_options *options);
+
+uint32_t neutron_loop_group_get_count(struct neutron_loop_group *group);
+
+struct neutron_loop *
+neutron_loop_group_get_loop(struct neutron_loop_group *group, uint32_t index);
+
+int neutron_loop_group_start(struct neutron_loop_group *group);
+
+int neutron_loop_group_stop(struct neutron_loop_group *group);
+
+void neutron_loop_group_destroy(struct neutron_loop_group *group);
+
 /* address parsing public API */
+
+/* "unix:name", "inet:1.2.3.4:port" or "inet6:[::1]:port" */
 struct neutron_addr *neutron_addr_parse(const char *address);
 
 socklen_t neutron_addr_get_len(struct neutron_addr *addr);
@@ -95,6 +254,18 @@ struct neutron_ctx *neutron_ctx_create_with_loop(neutron_ctx_event_cb cb,
 						 struct neutron_loop *loop,
 						 void *userdata);
 
+/* Server ctx sharded over the loops of a group: each loop gets its own
+ * SO_REUSEPORT listener and keeps the connections it accepted. Callbacks
+ * run on the loop threads and receive the shard ctx. Set it up before
+ * neutron_loop_group_start(). The connections belong to the loop threads:
+ * listen, send, pool, disconnect and destroy calls on the group ctx fail
+ * with EBUSY while the group runs. Stop it first, or send from the
+ * callbacks on the shard ctx. */
+struct neutron_ctx *
+neutron_ctx_create_with_group(neutron_ctx_event_cb cb,
+			      struct neutron_loop_group *group,
+			      void *userdata);
+
 struct neutron_loop *neutron_ctx_get_loop(struct neutron_ctx *ctx);
 
 int neutron_ctx_set_socket_data_cb(struct neutron_ctx *ctx,
@@ -105,14 +276,157 @@ int neutron_ctx_set_socket_fd_cb(struct neutron_ctx *ctx, neutron_ctx_fd_cb cb);
 int neutron_ctx_set_socket_event_cb(struct neutron_ctx *ctx,
 				    neutron_ctx_event_cb cb);
 
+int neutron_ctx_set_edge_triggered(struct neutron_ctx *ctx, int enable);
+
+/* Length of the listen queue, SOMAXCONN by default. Applied immediately
+ * when the ctx is already listening. */
+int neutron_ctx_set_listen_backlog(struct neutron_ctx *ctx, int backlog);
+
+/* Data the socket does not take is queued on the conn and flushed when it
+ * turns writable. NEUTRON_EVENT_WRITE_HIGH_WATERMARK is emitted once the
+ * queue holds high bytes, NEUTRON_EVENT_WRITE_LOW_WATERMARK once it drained
+ * to low bytes again. Defaults are 256KiB and 1MiB. */
+int neutron_ctx_set_write_watermarks(struct neutron_ctx *ctx,
+				     size_t low,
+				     size_t high);
+
+/* Outbound multicast of a DGRAM ctx: hop limit, local delivery of the
+ * datagrams sent and interface by name, NULL for the routing default.
+ * Applies to the socket once bound. */
+int neutron_ctx_set_multicast(struct neutron_ctx *ctx,
+			      int ttl,
+			      int loop,
+			      const char *ifname);
+
+/* Joins an IPv4 or IPv6 group on a bound DGRAM ctx, the port of group is
+ * ignored. With a source, only the datagrams it sends are received. ifname
+ * NULL lets the routing table pick the interface. */
+int neutron_ctx_join_group(struct neutron_ctx *ctx,
+			   struct neutron_addr *group,
+			   struct neutron_addr *source,
+			   const char *ifname);
+
+/* leaves a membership taken with neutron_ctx_join_group */
+int neutron_ctx_leave_group(struct neutron_ctx *ctx,
+			    struct neutron_addr *group,
+			    struct neutron_addr *source,
+			    const char *ifname);
+
+/* Read buffer of the connections created from now on, 512 bytes by
+ * default. A stream conn doubles it up to max_size while reads fill it, and
+ * shrinks it back once traffic calms down. Reads are repeated until the
+ * buffer is not full before data_cb is called. Datagrams larger than size
+ * are dropped with a warning. */
+int neutron_ctx_set_read_buffer(struct neutron_ctx *ctx,
+				size_t size,
+				size_t max_size);
+
+/* Read up to count datagrams per recvmmsg into a ring of buffers of the
+ * read buffer size. cb gets each batch, or data_cb is called per datagram
+ * when cb is NULL. A count of 1 goes back to one recvfrom per datagram. */
+int neutron_ctx_set_dgram_batch(struct neutron_ctx *ctx,
+				uint32_t count,
+				neutron_ctx_dgram_batch_cb cb);
+
+/* Give each peer of a DGRAM ctx its own conn, looked up by address in a
+ * hash table. The first datagram of a peer reports its conn CONNECTED and
+ * data_cb gets that conn, neutron_conn_send on it replies to the peer. A
+ * conn silent for idle_ms is reported DISCONNECTED and released, 0 keeps
+ * sessions until disabled or disconnected. */
+int neutron_ctx_set_dgram_sessions(struct neutron_ctx *ctx,
+				   int enable,
+				   uint32_t idle_ms);
+
+/* UDP offload of a DGRAM ctx. With a gso_size, neutron_ctx_send_to splits
+ * a buffer longer than gso_size into datagrams of gso_size bytes, the last
+ * one may be shorter, and hands up to 64 of them to the kernel per send.
+ * Routes without offload fall back to sendmmsg. With gro, the kernel
+ * coalesces datagrams of a sender and each one is still delivered on its
+ * own, as a batch to the dgram batch cb when set. 0 disables either. */
+int neutron_ctx_set_udp_offload(struct neutron_ctx *ctx,
+				uint16_t gso_size,
+				int gro);
+
+/* Frame the stream connections of the ctx: data_cb is called once per
+ * complete frame with its payload, prefix excluded, pointing into the read
+ * buffer. size is the prefix length of NEUTRON_FRAME_FIXED. A frame longer
+ * than max_len drops the connection. Datagrams are not affected. */
+int neutron_ctx_set_framing(struct neutron_ctx *ctx,
+			    enum neutron_frame_prefix prefix,
+			    uint32_t size,
+			    uint32_t max_len);
+
+/* Released connections are kept with their read buffer, up to max per
+ * ctx (64 by default), and reused for the next ones. prewarm connections
+ * are allocated right away, per shard on a loop group ctx. */
+int neutron_ctx_set_conn_pool(struct neutron_ctx *ctx,
+			      uint32_t prewarm,
+			      uint32_t max);
+
+/* Counters are summed over the shards of a loop group ctx */
+int neutron_ctx_get_pool_stats(struct neutron_ctx *ctx,
+			       struct neutron_ctx_pool_stats *stats);
+
+/* Maximum accept attempts per listener wakeup, failed ones included, so
+ * that an accept storm cannot starve the other fds of the loop */
+int neutron_ctx_set_accept_batch(struct neutron_ctx *ctx, uint32_t max);
+
+/* Counters are summed over the shards of a loop group ctx */
+int neutron_ctx_get_accept_stats(struct neutron_ctx *ctx,
+				 struct neutron_ctx_accept_stats *stats);
+
+/* Opt in to zero-copy sends: connections of the ctx set SO_ZEROCOPY, and cb
+ * is called from the loop once the kernel no longer references the memory
+ * given to neutron_ctx_send_zerocopy */
+int neutron_ctx_set_zerocopy(struct neutron_ctx *ctx,
+			     neutron_ctx_zc_release_cb cb);
+
+/* Counters are summed over the shards of a loop group ctx */
+int neutron_ctx_get_zerocopy_stats(struct neutron_ctx *ctx,
+				   struct neutron_ctx_zerocopy_stats *stats);
+
 int neutron_ctx_listen(struct neutron_ctx *ctx, struct neutron_addr *addr);
 
 int neutron_ctx_connect(struct neutron_ctx *ctx, struct neutron_addr *addr);
 
+/* Non-blocking connect: NEUTRON_EVENT_CONNECTED or
+ * NEUTRON_EVENT_CONNECT_FAILED is emitted from the loop once the handshake
+ * is over. A non zero timeout_ms fails the attempt with ETIMEDOUT. Errors
+ * detected before the handshake starts are returned directly. */
+int neutron_ctx_connect_async(struct neutron_ctx *ctx,
+			      struct neutron_addr *addr,
+			      uint32_t timeout_ms);
+
+/* errno of the last failed asynchronous connect */
+int neutron_ctx_get_connect_error(struct neutron_ctx *ctx);
+
 int neutron_ctx_disconnect(struct neutron_ctx *ctx);
 
 int neutron_ctx_send(struct neutron_ctx *ctx, uint8_t *buf, uint32_t buflen);
 
+/* Gathers the segments in one sendmsg, only the part the socket does not
+ * take is copied to the write queue */
+int neutron_ctx_sendv(struct neutron_ctx *ctx,
+		      const struct iovec *iov,
+		      int iovcnt);
+
+/* Sends buf with MSG_ZEROCOPY, it must stay untouched until the release
+ * callback reports it with cookie. Pending data is queued by reference.
+ * Connections without SO_ZEROCOPY copy it, the callback may then run
+ * before this returns. */
+int neutron_ctx_send_zerocopy(struct neutron_ctx *ctx,
+			      const uint8_t *buf,
+			      size_t buflen,
+			      void *cookie);
+
+/* Queues buf on every connection of the ctx by reference, each socket
+ * first takes what it can right away. A failing connection does not stop
+ * the fan-out: it is reported to cb, or logged when cb is NULL, and the
+ * first error is returned. The caller keeps its reference. */
+int neutron_ctx_send_buf(struct neutron_ctx *ctx,
+			 struct neutron_buf *buf,
+			 neutron_ctx_send_error_cb cb);
+
 int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr);
 
 int neutron_ctx_broadcast(struct neutron_ctx *ctx);
@@ -122,8 +436,53 @@ int neutron_ctx_send_to(struct neutron_ctx *ctx,
 			uint8_t *buf,
 			uint32_t buflen);
 
+/* Sends the datagrams with sendmmsg, stops at the first one that fails
+ * and returns its error. sent, when not NULL, gets the number sent. */
+int neutron_ctx_send_to_batch(struct neutron_ctx *ctx,
+			      const struct neutron_dgram *dgrams,
+			      uint32_t count,
+			      uint32_t *sent);
+
 void neutron_ctx_destroy(struct neutron_ctx *ctx);
 
+/* conn public API */
+
+/* bytes queued for sending on the conn */
+size_t neutron_conn_get_write_pending(struct neutron_conn *conn);
+
+void neutron_conn_set_userdata(struct neutron_conn *conn, void *userdata);
+
+void *neutron_conn_get_userdata(struct neutron_conn *conn);
+
+/* Sends on this conn only, through the same non-blocking write queue as
+ * neutron_ctx_send. On a datagram ctx the buffer goes to the peer of the
+ * last datagram received. */
+int neutron_conn_send(struct neutron_conn *conn,
+		      const uint8_t *buf,
+		      uint32_t buflen);
+
+/* vectored send on this conn only, see neutron_ctx_sendv */
+int neutron_conn_sendv(struct neutron_conn *conn,
+		       const struct iovec *iov,
+		       int iovcnt);
+
+/* shared buffer variant of neutron_conn_send */
+int neutron_conn_send_buf(struct neutron_conn *conn, struct neutron_buf *buf);
+
+/* shared buffer public API: immutable once sent, freed with its last
+ * reference. References may be dropped from any thread. */
+
+/* copies len bytes of data, or leaves them to fill when data is NULL */
+struct neutron_buf *neutron_buf_new(const uint8_t *data, size_t len);
+
+uint8_t *neutron_buf_get_data(struct neutron_buf *buf);
+
+size_t neutron_buf_get_len(struct neutron_buf *buf);
+
+struct neutron_buf *neutron_buf_ref(struct neutron_buf *buf);
+
+void neutron_buf_unref(struct neutron_buf *buf);
+
 /* event public API */
 
 struct neutron_evt *neutron_evt_create(int flags, neutron_evt_cb cb);
@@ -146,6 +505,11 @@ struct neutron_timer *neutron_timer_create_with_loop(struct neutron_loop *loop,
 						     neutron_timer_cb cb,
 						     void *userdata);
 
+struct neutron_timer *neutron_timer_create_with_flags(struct neutron_loop *loop,
+						      uint32_t flags,
+						      neutron_timer_cb cb,
+						      void *userdata);
+
 struct neutron_loop *neutron_timer_get_loop(struct neutron_timer *timer);
 
 void neutron_timer_destroy(struct neutron_timer *timer);
@@ -156,6 +520,28 @@ int neutron_timer_set_periodic(struct neutron_timer *timer,
 
 int neutron_timer_set(struct neutron_timer *timer, uint32_t delay);
 
+/* nanosecond variants, a zero period makes the timer single shot */
+int neutron_timer_set_ns(struct neutron_timer *timer,
+			 uint64_t delay_ns,
+			 uint64_t period_ns);
+
+/* deadline_ns is an absolute CLOCK_MONOTONIC time */
+int neutron_timer_set_abs(struct neutron_timer *timer,
+			  uint64_t deadline_ns,
+			  uint64_t period_ns);
+
+/* Allow the timer to fire up to slack_ns late so that nearby expirations
+ * share a wakeup. Applies to the following set calls. */
+int neutron_timer_set_slack(struct neutron_timer *timer, uint64_t slack_ns);
+
+/* Replaces the plain callback with one that receives the number of
+ * expirations being delivered. */
+int neutron_timer_set_overrun_cb(struct neutron_timer *timer,
+				 neutron_timer_overrun_cb cb);
+
+int neutron_timer_set_overrun_policy(struct neutron_timer *timer,
+				     enum neutron_timer_overrun_policy policy);
+
 int neutron_timer_clear(struct neutron_timer *timer);
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@ namespace neutron {
 
 class Address;
 class Loop;
+class LoopGroup;
 class Context;
 class Connection;
 class Event;
@@ -62,6 +63,11 @@ public:
 		mLoop = loop;
 	}
 
+	inline Loop(const struct neutron_loop_options &options)
+	{
+		mLoop = neutron_loop_create_with_options(&options);
+	}
+
 	inline ~Loop()
 	{
 		neutron_loop_destroy(mLoop);
@@ -78,6 +84,11 @@ public:
 		return neutron_loop_find_fd(mLoop, fd);
 	}
 
+	inline int rearm(int fd, uint32_t events)
+	{
+		return neutron_loop_rearm(mLoop, fd, events);
+	}
+
 	inline int remove(int fd)
 	{
 		return neutron_loop_remove(mLoop, fd);
@@ -93,6 +104,11 @@ public:
 		neutron_loop_wakeup(mLoop);
 	}
 
+	inline int post(neutron_loop_task_cb cb, void *arg)
+	{
+		return neutron_loop_post(mLoop, cb, arg);
+	}
+
 	inline operator struct neutron_loop *()
 	{
 		return mLoop;
@@ -116,6 +132,48 @@ private:
 	struct neutron_loop *mLoop;
 };
 
+class LoopGroup {
+public:
+	inline LoopGroup(uint32_t count = 0,
+			 const struct neutron_loop_options *options = nullptr)
+	{
+		mGroup = neutron_loop_group_create(count, options);
+	}
+
+	inline ~LoopGroup()
+	{
+		neutron_loop_group_destroy(mGroup);
+	}
+
+	inline int start()
+	{
+		return neutron_loop_group_start(mGroup);
+	}
+
+	inline int stop()
+	{
+		return neutron_loop_group_stop(mGroup);
+	}
+
+	inline uint32_t count()
+	{
+		return neutron_loop_group_get_count(mGroup);
+	}
+
+	inline struct neutron_loop *getLoop(uint32_t index)
+	{
+		return neutron_loop_group_get_loop(mGroup, index);
+	}
+
+	inline struct neutron_loop_group *getGroup()
+	{
+		return mGroup;
+	}
+
+private:
+	struct neutron_loop_group *mGroup;
+};
+
 class Connection {
 public:
 	Connection(struct neutron_conn *_conn)
@@ -123,6 +181,41 @@ public:
 		mConn = _conn;
 	}
 
+	size_t getWritePending() const
+	{
+		return neutron_conn_get_write_pending(mConn);
+	}
+
+	void setUserdata(void *userdata)
+	{
+		neutron_conn_set_userdata(mConn, userdata);
+	}
+
+	void *getUserdata() const
+	{
+		return neutron_conn_get_userdata(mConn);
+	}
+
+	int send(const uint8_t *buf, uint32_t buflen)
+	{
+		return neutron_conn_send(mConn, buf, buflen);
+	}
+
+	int send(const std::vector<uint8_t> &buf)
+	{
+		return neutron_conn_send(mConn, buf.data(), buf.size());
+	}
+
+	int sendv(const struct iovec *iov, int iovcnt)
+	{
+		return neutron_conn_sendv(mConn, iov, iovcnt);
+	}
+
+	int send(struct neutron_buf *buf)
+	{
+		return neutron_conn_send_buf(mConn, buf);
+	}
+
 private:
 	struct neutron_conn *mConn;
 	friend class Context;
@@ -147,6 +240,22 @@ public:
 			Context *ctx,
 			Connection *conn,
 			const std::vector<uint8_t> &buf) = 0;
+		inline virtual void onConnectFailed(Context *ctx, int error) {}
+		/* outbound queue of conn crossed the high or low watermark */
+		inline virtual void onWriteHighWatermark(Context *ctx,
+							 Connection *conn)
+		{
+		}
+		inline virtual void onWriteLowWatermark(Context *ctx,
+							Connection *conn)
+		{
+		}
+		/* buf of a zero-copy send may be reused */
+		inline virtual void onZeroCopyReleased(Context *ctx,
+						       const uint8_t *buf,
+						       void *cookie)
+		{
+		}
 	};
 
 public:
@@ -199,6 +308,107 @@ public:
 		return mLoop;
 	}
 
+	int setEdgeTriggered(bool enable)
+	{
+		return neutron_ctx_set_edge_triggered(mCtx, enable);
+	}
+
+	int setListenBacklog(int backlog)
+	{
+		return neutron_ctx_set_listen_backlog(mCtx, backlog);
+	}
+
+	int setReadBuffer(size_t size, size_t maxSize)
+	{
+		return neutron_ctx_set_read_buffer(mCtx, size, maxSize);
+	}
+
+	int setDgramBatch(uint32_t count)
+	{
+		return neutron_ctx_set_dgram_batch(mCtx, count, nullptr);
+	}
+
+	int setMulticast(int ttl, bool loop, const char *ifname = nullptr)
+	{
+		return neutron_ctx_set_multicast(mCtx, ttl, loop, ifname);
+	}
+
+	int joinGroup(Address &group, const char *ifname = nullptr)
+	{
+		return neutron_ctx_join_group(
+			mCtx, group.addr(), nullptr, ifname);
+	}
+
+	int joinGroup(Address &group,
+		      Address &source,
+		      const char *ifname = nullptr)
+	{
+		return neutron_ctx_join_group(
+			mCtx, group.addr(), source.addr(), ifname);
+	}
+
+	int leaveGroup(Address &group, const char *ifname = nullptr)
+	{
+		return neutron_ctx_leave_group(
+			mCtx, group.addr(), nullptr, ifname);
+	}
+
+	int leaveGroup(Address &group,
+		       Address &source,
+		       const char *ifname = nullptr)
+	{
+		return neutron_ctx_leave_group(
+			mCtx, group.addr(), source.addr(), ifname);
+	}
+
+	int setDgramSessions(bool enable, uint32_t idleMs = 0)
+	{
+		return neutron_ctx_set_dgram_sessions(mCtx, enable, idleMs);
+	}
+
+	int setUdpOffload(uint16_t gsoSize, bool gro)
+	{
+		return neutron_ctx_set_udp_offload(mCtx, gsoSize, gro);
+	}
+
+	int setFraming(enum neutron_frame_prefix prefix,
+		       uint32_t size,
+		       uint32_t maxLen)
+	{
+		return neutron_ctx_set_framing(mCtx, prefix, size, maxLen);
+	}
+
+	int setConnPool(uint32_t prewarm, uint32_t max)
+	{
+		return neutron_ctx_set_conn_pool(mCtx, prewarm, max);
+	}
+
+	int getPoolStats(struct neutron_ctx_pool_stats &stats)
+	{
+		return neutron_ctx_get_pool_stats(mCtx, &stats);
+	}
+
+	int setAcceptBatch(uint32_t max)
+	{
+		return neutron_ctx_set_accept_batch(mCtx, max);
+	}
+
+	int getAcceptStats(struct neutron_ctx_accept_stats &stats)
+	{
+		return neutron_ctx_get_accept_stats(mCtx, &stats);
+	}
+
+	int setZeroCopy()
+	{
+		return neutron_ctx_set_zerocopy(mCtx,
+						&Context::zeroCopyCallback);
+	}
+
+	int getZeroCopyStats(struct neutron_ctx_zerocopy_stats &stats)
+	{
+		return neutron_ctx_get_zerocopy_stats(mCtx, &stats);
+	}
+
 	int listen(struct neutron_addr *addr)
 	{
 		return neutron_ctx_listen(mCtx, addr);
@@ -219,6 +429,17 @@ public:
 		return neutron_ctx_connect(mCtx, address.addr());
 	}
 
+	int connectAsync(struct neutron_addr *addr, uint32_t timeoutMs = 0)
+	{
+		return neutron_ctx_connect_async(mCtx, addr, timeoutMs);
+	}
+
+	int connectAsync(Address &address, uint32_t timeoutMs = 0)
+	{
+		return neutron_ctx_connect_async(
+			mCtx, address.addr(), timeoutMs);
+	}
+
 	int bind(struct neutron_addr *addr)
 	{
 		return neutron_ctx_bind(mCtx, addr);
@@ -244,6 +465,24 @@ public:
 		return neutron_ctx_send(mCtx, buf, buflen);
 	}
 
+	int sendv(const struct iovec *iov, int iovcnt)
+	{
+		return neutron_ctx_sendv(mCtx, iov, iovcnt);
+	}
+
+	int send(struct neutron_buf *buf,
+		 neutron_ctx_send_error_cb cb = nullptr)
+	{
+		return neutron_ctx_send_buf(mCtx, buf, cb);
+	}
+
+	int sendZeroCopy(const uint8_t *buf,
+			 size_t buflen,
+			 void *cookie = nullptr)
+	{
+		return neutron_ctx_send_zerocopy(mCtx, buf, buflen, cookie);
+	}
+
 	int sendTo(struct neutron_addr *addr, uint8_t *buf, uint32_t buflen)
 	{
 		return neutron_ctx_send_to(mCtx, addr, buf, buflen);
@@ -254,6 +493,13 @@ public:
 		return neutron_ctx_send_to(mCtx, address.addr(), buf, buflen);
 	}
 
+	int sendToBatch(const struct neutron_dgram *dgrams,
+			uint32_t count,
+			uint32_t *sent = nullptr)
+	{
+		return neutron_ctx_send_to_batch(mCtx, dgrams, count, sent);
+	}
+
 private:
 	inline static void eventCallback(struct neutron_ctx *_ctx,
 					 enum neutron_event _event,
@@ -281,6 +527,20 @@ private:
 			break;
 		case NEUTRON_EVENT_DATA:
 			break;
+		case NEUTRON_EVENT_WRITE_HIGH_WATERMARK:
+		case NEUTRON_EVENT_WRITE_LOW_WATERMARK:
+			it = ctx->findConn(_conn);
+			if (it == ctx->mConnections.end())
+				break;
+			if (_event == NEUTRON_EVENT_WRITE_HIGH_WATERMARK)
+				ctx->mHandler->onWriteHighWatermark(ctx, *it);
+			else
+				ctx->mHandler->onWriteLowWatermark(ctx, *it);
+			break;
+		case NEUTRON_EVENT_CONNECT_FAILED:
+			ctx->mHandler->onConnectFailed(
+				ctx, neutron_ctx_get_connect_error(_ctx));
+			break;
 		default:
 			break;
 		}
@@ -313,6 +573,15 @@ private:
 			delete conn;
 	}
 
+	inline static void zeroCopyCallback(struct neutron_ctx *_ctx,
+					    const uint8_t *_buf,
+					    void *_cookie,
+					    void *_userdata)
+	{
+		Context *ctx = reinterpret_cast<Context *>(_userdata);
+		ctx->mHandler->onZeroCopyReleased(ctx, _buf, _cookie);
+	}
+
 	inline static void fdCallback(struct neutron_ctx *_ctx,
 				      int _fd,
 				      void *_userdata)
@@ -347,6 +616,13 @@ public:
 		inline Handler() {}
 		inline virtual ~Handler() {}
 		inline virtual void processTimer() = 0;
+
+		/* called instead of processTimer once an overrun policy is
+		 * set, expirations is what the policy delivers */
+		inline virtual void processTimerExpirations(uint64_t expirations)
+		{
+			processTimer();
+		}
 	};
 
 public:
@@ -356,10 +632,11 @@ public:
 		mLoop = new Loop(neutron_timer_get_loop(mTimer));
 	}
 
-	Timer(Loop *loop, Handler *handler) : mLoop(loop), mHandler(handler)
+	Timer(Loop *loop, Handler *handler, uint32_t flags = 0)
+		: mLoop(loop), mHandler(handler)
 	{
-		mTimer = neutron_timer_create_with_loop(
-			mLoop->getLoop(), &Timer::timerCallback, this);
+		mTimer = neutron_timer_create_with_flags(
+			mLoop->getLoop(), flags, &Timer::timerCallback, this);
 	}
 	~Timer()
 	{
@@ -375,6 +652,30 @@ public:
 				mTimer, delay, period);
 	}
 
+	int setNs(uint64_t delayNs, uint64_t periodNs = 0)
+	{
+		return neutron_timer_set_ns(mTimer, delayNs, periodNs);
+	}
+
+	int setAbs(uint64_t deadlineNs, uint64_t periodNs = 0)
+	{
+		return neutron_timer_set_abs(mTimer, deadlineNs, periodNs);
+	}
+
+	int setSlack(uint64_t slackNs)
+	{
+		return neutron_timer_set_slack(mTimer, slackNs);
+	}
+
+	int setOverrunPolicy(enum neutron_timer_overrun_policy policy)
+	{
+		int ret = neutron_timer_set_overrun_cb(
+			mTimer, &Timer::timerOverrunCallback);
+		if (ret)
+			return ret;
+		return neutron_timer_set_overrun_policy(mTimer, policy);
+	}
+
 	int clear()
 	{
 		return neutron_timer_clear(mTimer);
@@ -387,6 +688,14 @@ private:
 		timer->mHandler->processTimer();
 	}
 
+	static void timerOverrunCallback(struct neutron_timer *_timer,
+					 uint64_t _expirations,
+					 void *_userdata)
+	{
+		Timer *timer = reinterpret_cast<Timer *>(_userdata);
+		timer->mHandler->processTimerExpirations(_expirations);
+	}
+
 private:
 	struct neutron_timer *mTimer;
 	Loop *mLoop;
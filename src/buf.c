@@ -0,0 +1,73 @@
+#include <buf.h>
+#include <ctx.h>
+
+struct neutron_buf *neutron_buf_new(const uint8_t *data, size_t len)
+{
+	struct neutron_buf *buf = malloc(sizeof(struct neutron_buf) + len);
+	if (!buf) {
+		LOG_ERRNO("Failed to allocate memory for shared buffer");
+		return NULL;
+	}
+
+	if (data)
+		memcpy(buf->storage, data, len);
+
+	buf->data = buf->storage;
+	buf->len = len;
+	buf->refs = 1;
+	buf->zc_ctx = NULL;
+	buf->cookie = NULL;
+	return buf;
+}
+
+struct neutron_buf *buf_new_zerocopy(struct neutron_ctx *ctx,
+				     const uint8_t *data,
+				     size_t len,
+				     void *cookie)
+{
+	struct neutron_buf *buf = malloc(sizeof(struct neutron_buf));
+	if (!buf) {
+		LOG_ERRNO("Failed to allocate memory for zero-copy buffer");
+		return NULL;
+	}
+
+	buf->data = data;
+	buf->len = len;
+	buf->refs = 1;
+	buf->zc_ctx = ctx;
+	buf->cookie = cookie;
+	return buf;
+}
+
+uint8_t *neutron_buf_get_data(struct neutron_buf *buf)
+{
+	/* the memory of a zero-copy send belongs to the caller */
+	if (!buf || buf->zc_ctx)
+		return NULL;
+
+	return buf->storage;
+}
+
+size_t neutron_buf_get_len(struct neutron_buf *buf)
+{
+	return buf ? buf->len : 0;
+}
+
+struct neutron_buf *neutron_buf_ref(struct neutron_buf *buf)
+{
+	if (buf)
+		__atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+	return buf;
+}
+
+void neutron_buf_unref(struct neutron_buf *buf)
+{
+	if (!buf || __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	struct neutron_ctx *ctx = buf->zc_ctx;
+	if (ctx && ctx->zc_release_cb)
+		(*ctx->zc_release_cb)(
+			ctx, buf->data, buf->cookie, ctx->userdata);
+	free(buf);
+}
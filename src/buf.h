@@ -0,0 +1,27 @@
+#ifndef _BUF_H_
+#define _BUF_H_
+
+#include <neutron_priv.h>
+#include <neutron.h>
+
+/* immutable buffer queued by reference on the conns it is sent to. The
+ * conns of a loop group drop their references from their own threads. */
+struct neutron_buf {
+	const uint8_t *data;
+	size_t len;
+	uint32_t refs;
+
+	/* caller memory of a zero-copy send, handed back to the release
+	 * callback of this ctx */
+	struct neutron_ctx *zc_ctx;
+	void *cookie;
+
+	uint8_t storage[];
+};
+
+struct neutron_buf *buf_new_zerocopy(struct neutron_ctx *ctx,
+				     const uint8_t *data,
+				     size_t len,
+				     void *cookie);
+
+#endif
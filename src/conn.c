@@ -1,7 +1,13 @@
 #include <conn.h>
 #include <ctx.h>
+#include <wheel.h>
 
-struct neutron_conn *neutron_conn_new(int capacity)
+#define CONN_URING(op, member)                                                 \
+	((struct neutron_conn_uring *)((char *)(op)                            \
+				       - offsetof(struct neutron_conn_uring,   \
+						  member)))
+
+struct neutron_conn *neutron_conn_new(size_t capacity)
 {
 	struct neutron_conn *conn = NULL;
 
@@ -23,99 +29,1395 @@ struct neutron_conn *neutron_conn_new(int capacity)
 	conn->remove = 0;
 	conn->fd = -1;
 
-	conn->local = (struct sockaddr_storage *)calloc(
-		1, sizeof(struct sockaddr_storage));
+	/* the addresses live in the conn, saving two allocations */
+	conn->local = &conn->local_ss;
+	conn->peer = &conn->peer_ss;
 
-	if (!conn->local) {
-		LOG_ERRNO(
-			"Failed to allocate memory for local address in conn");
-		free(conn);
-		conn = NULL;
-		return NULL;
+	return conn;
+}
+
+/* reset of a released conn so that it can be handed out again */
+static int conn_recycle(struct neutron_conn *conn, size_t capacity)
+{
+	uint8_t *data = conn->readbuf.data;
+
+	if (conn->readbuf.capacity != capacity) {
+		data = realloc(data, capacity);
+		if (!data)
+			return ENOMEM;
 	}
 
-	conn->peer = (struct sockaddr_storage *)calloc(
-		1, sizeof(struct sockaddr_storage));
+	memset(conn, 0, sizeof(struct neutron_conn));
+	conn->readbuf.data = data;
+	conn->readbuf.capacity = capacity;
+	conn->fd = -1;
+	conn->local = &conn->local_ss;
+	conn->peer = &conn->peer_ss;
+	return 0;
+}
 
-	if (!conn->peer) {
-		LOG_ERRNO(
-			"Failed to allocate memory for remote peer address in conn");
-		free(conn->local);
-		conn->local = NULL;
-		free(conn);
-		conn = NULL;
-		return NULL;
+struct neutron_conn *conn_pool_get(struct neutron_ctx *ctx)
+{
+	struct neutron_conn_pool *pool = &ctx->pool;
+	struct neutron_conn *conn = pool->head;
+
+	if (conn) {
+		pool->head = conn->next;
+		__atomic_sub_fetch(&pool->stats.available, 1, __ATOMIC_RELAXED);
+
+		/* the read buffer size of the ctx may have changed since */
+		if (conn->readbuf.capacity == ctx->readbuf_size
+		    || conn_recycle(conn, ctx->readbuf_size) == 0) {
+			conn->next = NULL;
+			__atomic_add_fetch(
+				&pool->stats.hits, 1, __ATOMIC_RELAXED);
+			return conn;
+		}
+		neutron_conn_destroy(conn);
 	}
 
-	return conn;
+	__atomic_add_fetch(&pool->stats.misses, 1, __ATOMIC_RELAXED);
+	return neutron_conn_new(ctx->readbuf_size);
+}
+
+void conn_pool_put(struct neutron_ctx *ctx, struct neutron_conn *conn)
+{
+	struct neutron_conn_pool *pool = &ctx->pool;
+
+	conn_uring_release(conn);
+
+	if (pool->stats.available >= pool->max) {
+		__atomic_add_fetch(&pool->stats.dropped, 1, __ATOMIC_RELAXED);
+		neutron_conn_destroy(conn);
+		return;
+	}
+
+	if (conn->fd > 0)
+		close(conn->fd);
+	conn_ring_free(conn);
+	conn_zc_clear(conn);
+	conn_writeq_clear(conn);
+
+	/* a grown read buffer goes back to the ctx size */
+	if (conn_recycle(conn, ctx->readbuf_size)) {
+		conn->fd = -1;
+		neutron_conn_destroy(conn);
+		return;
+	}
+
+	conn->next = pool->head;
+	pool->head = conn;
+	__atomic_add_fetch(&pool->stats.available, 1, __ATOMIC_RELAXED);
+}
+
+int conn_pool_prewarm(struct neutron_ctx *ctx, uint32_t count)
+{
+	struct neutron_conn_pool *pool = &ctx->pool;
+
+	while (pool->stats.available < count
+	       && pool->stats.available < pool->max) {
+		struct neutron_conn *conn = neutron_conn_new(ctx->readbuf_size);
+		if (!conn)
+			return ENOMEM;
+
+		conn->next = pool->head;
+		pool->head = conn;
+		__atomic_add_fetch(&pool->stats.available, 1, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+void conn_pool_clear(struct neutron_ctx *ctx)
+{
+	struct neutron_conn_pool *pool = &ctx->pool;
+
+	while (pool->head) {
+		struct neutron_conn *conn = pool->head;
+		pool->head = conn->next;
+		neutron_conn_destroy(conn);
+	}
+	pool->stats.available = 0;
+}
+
+static int conn_watch_write(struct neutron_conn *conn, int enable)
+{
+	uint32_t events = neutron_ctx_conn_events(conn->ctx);
+	if (enable)
+		events |= NEUTRON_FD_EVENT_OUT;
+
+	return neutron_loop_rearm(conn->ctx->loop, conn->fd, events);
+}
+
+static void conn_wbufs_free(struct neutron_conn_wbuf *wbuf)
+{
+	while (wbuf) {
+		struct neutron_conn_wbuf *next = wbuf->next;
+		neutron_buf_unref(wbuf->shared);
+		free(wbuf);
+		wbuf = next;
+	}
+}
+
+void conn_writeq_clear(struct neutron_conn *conn)
+{
+	conn_wbufs_free(conn->writeq.head);
+
+	conn->writeq.head = NULL;
+	conn->writeq.tail = NULL;
+	conn->writeq.pending = 0;
+	conn->writeq.throttled = 0;
+}
+
+static void conn_writeq_push(struct neutron_conn *conn,
+			     struct neutron_conn_wbuf *wbuf)
+{
+	if (conn->writeq.tail)
+		conn->writeq.tail->next = wbuf;
+	else
+		conn->writeq.head = wbuf;
+	conn->writeq.tail = wbuf;
+	conn->writeq.pending += wbuf->len;
+}
+
+/* queues iov from byte skip on, as a single chunk */
+static int conn_writeq_append(struct neutron_conn *conn,
+			      const struct iovec *iov,
+			      int iovcnt,
+			      size_t skip)
+{
+	size_t buflen = 0;
+	for (int i = 0; i < iovcnt; i++)
+		buflen += iov[i].iov_len;
+	buflen -= skip;
+
+	struct neutron_conn_wbuf *wbuf =
+		malloc(sizeof(struct neutron_conn_wbuf) + buflen);
+	if (!wbuf) {
+		LOG_ERRNO("Failed to allocate memory for pending data");
+		return ENOMEM;
+	}
+
+	size_t off = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		size_t len = iov[i].iov_len;
+		const uint8_t *base = iov[i].iov_base;
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+		memcpy(wbuf->data + off, base + skip, len - skip);
+		off += len - skip;
+		skip = 0;
+	}
+
+	wbuf->len = buflen;
+	wbuf->off = 0;
+	wbuf->base = wbuf->data;
+	wbuf->shared = NULL;
+	wbuf->next = NULL;
+
+	conn_writeq_push(conn, wbuf);
+	return 0;
+}
+
+/* drops the len bytes the socket took from the head of the queue */
+static void conn_writeq_consume(struct neutron_conn *conn, size_t len)
+{
+	conn->writeq.pending -= len;
+	while (len > 0) {
+		struct neutron_conn_wbuf *wbuf = conn->writeq.head;
+		size_t left = wbuf->len - wbuf->off;
+		if (len < left) {
+			wbuf->off += len;
+			break;
+		}
+
+		len -= left;
+		conn->writeq.head = wbuf->next;
+		neutron_buf_unref(wbuf->shared);
+		free(wbuf);
+	}
+	if (!conn->writeq.head)
+		conn->writeq.tail = NULL;
+}
+
+static void conn_writeq_drained(struct neutron_ctx *ctx,
+				struct neutron_conn *conn)
+{
+	if (conn->writeq.throttled
+	    && conn->writeq.pending <= ctx->write_low_watermark) {
+		conn->writeq.throttled = 0;
+		neutron_ctx_notify_event(
+			ctx, NEUTRON_EVENT_WRITE_LOW_WATERMARK, conn);
+	}
+}
+
+/* submits the head of the queue, new chunks only link behind the ones in
+ * flight so the kernel can read them until the completion */
+static int conn_uring_flush(struct neutron_conn *conn)
+{
+	struct neutron_conn_uring *u = conn->uring;
+	struct neutron_conn_wbuf *wbuf = conn->writeq.head;
+	int iovcnt = 0;
+
+	if (u->sending || !wbuf)
+		return 0;
+
+	while (wbuf && iovcnt < CONN_WRITE_IOV_MAX) {
+		u->iov[iovcnt].iov_base = (void *)(wbuf->base + wbuf->off);
+		u->iov[iovcnt].iov_len = wbuf->len - wbuf->off;
+		iovcnt++;
+		wbuf = wbuf->next;
+	}
+
+	memset(&u->msg, 0, sizeof(u->msg));
+	u->msg.msg_iov = u->iov;
+	u->msg.msg_iovlen = iovcnt;
+
+	int ret = neutron_uring_sendmsg(u->loop, conn->fd, &u->msg, &u->send);
+	if (ret)
+		return ret;
+
+	u->sending = 1;
+	u->inflight++;
+	return 0;
+}
+
+/* polls for writability, or submits the send on io_uring, once the queue
+ * is no longer empty and reports the high watermark */
+static int conn_writeq_queued(struct neutron_conn *conn, int was_empty)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	int ret;
+
+	if (was_empty) {
+		if (conn->uring)
+			ret = conn_uring_flush(conn);
+		else
+			ret = conn_watch_write(conn, 1);
+		if (ret)
+			return ret;
+	}
+
+	if (!conn->writeq.throttled
+	    && conn->writeq.pending >= ctx->write_high_watermark) {
+		conn->writeq.throttled = 1;
+		neutron_ctx_notify_event(
+			ctx, NEUTRON_EVENT_WRITE_HIGH_WATERMARK, conn);
+	}
+
+	return 0;
+}
+
+int conn_sendv(struct neutron_conn *conn, const struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	size_t total = 0;
+	ssize_t len = 0;
+	int ret;
+
+	if (conn->remove)
+		return EPIPE;
+
+	if (iovcnt < 0 || (iovcnt > 0 && !iov))
+		return EINVAL;
+
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	if (total == 0)
+		return 0;
+
+	/* data must not overtake what is already queued, completion-based
+	 * conns always send from the queue */
+	if (!conn->writeq.head && !conn->uring) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = (struct iovec *)iov;
+		/* segments past IOV_MAX go to the queue */
+		msg.msg_iovlen = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+
+		do {
+			len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+		} while (len < 0 && errno == EINTR);
+
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return errno;
+			len = 0;
+		}
+
+		if ((size_t)len == total)
+			return 0;
+	}
+
+	int was_empty = conn->writeq.head == NULL;
+	ret = conn_writeq_append(conn, iov, iovcnt, len);
+	if (ret)
+		return ret;
+
+	return conn_writeq_queued(conn, was_empty);
+}
+
+int conn_sendv_dgram(struct neutron_conn *conn,
+		     const struct iovec *iov,
+		     int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t len;
+
+	if (iovcnt < 0 || (iovcnt > 0 && !iov))
+		return EINVAL;
+
+	if (conn->peer_addrlen == 0)
+		return EDESTADDRREQ;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = conn->peer;
+	msg.msg_namelen = conn->peer_addrlen;
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = iovcnt;
+
+	do {
+		len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+	} while (len < 0 && errno == EINTR);
+
+	return len < 0 ? errno : 0;
+}
+
+int conn_send(struct neutron_conn *conn, const uint8_t *buf, size_t buflen)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = buflen,
+	};
+
+	return conn_sendv(conn, &iov, 1);
+}
+
+int conn_enable_zerocopy(struct neutron_conn *conn)
+{
+	int opt = 1;
+
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt))
+	    < 0) {
+		/* e.g. unix sockets, their zero-copy sends are copied */
+		LOG_ERRNO("Failed to set SO_ZEROCOPY");
+		return errno;
+	}
+
+	conn->zc.enabled = 1;
+	return 0;
+}
+
+void conn_zc_clear(struct neutron_conn *conn)
+{
+	struct neutron_zc_pending *pending = conn->zc.head;
+
+	/* the socket is gone, no completion will come */
+	while (pending) {
+		struct neutron_zc_pending *next = pending->next;
+		neutron_buf_unref(pending->buf);
+		free(pending);
+		pending = next;
+	}
+
+	conn->zc.head = NULL;
+	conn->zc.tail = NULL;
+}
+
+/* sends one chunk of a zero-copy buffer, returns the bytes the socket took
+ * or a negative errno */
+static ssize_t conn_send_zc_chunk(struct neutron_conn *conn,
+				  struct neutron_buf *zc,
+				  const uint8_t *buf,
+				  size_t buflen)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	ssize_t len;
+
+	/* allocated first: a send that took data always gets a completion */
+	struct neutron_zc_pending *pending =
+		malloc(sizeof(struct neutron_zc_pending));
+	if (!pending) {
+		LOG_ERRNO("Failed to allocate memory for zero-copy send");
+		return -ENOMEM;
+	}
+
+	do {
+		len = send(conn->fd, buf, buflen, MSG_NOSIGNAL | MSG_ZEROCOPY);
+	} while (len < 0 && errno == EINTR);
+
+	/* the kernel only numbers sends that took data */
+	if (len > 0) {
+		pending->id = conn->zc.next_id++;
+		pending->buf = neutron_buf_ref(zc);
+		pending->next = NULL;
+		if (conn->zc.tail)
+			conn->zc.tail->next = pending;
+		else
+			conn->zc.head = pending;
+		conn->zc.tail = pending;
+		__atomic_add_fetch(&ctx->zc_stats.sends, 1, __ATOMIC_RELAXED);
+		return len;
+	}
+
+	free(pending);
+	if (len == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+		return 0;
+	if (errno != ENOBUFS)
+		return -errno;
+
+	/* out of socket option memory for completions, let the kernel copy */
+	do {
+		len = send(conn->fd, buf, buflen, MSG_NOSIGNAL);
+	} while (len < 0 && errno == EINTR);
+
+	if (len < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -errno;
+	return len;
+}
+
+int conn_send_buf(struct neutron_conn *conn, struct neutron_buf *buf)
+{
+	int zerocopy = buf->zc_ctx && conn->zc.enabled;
+	ssize_t len = 0;
+
+	if (conn->remove)
+		return EPIPE;
+
+	if (buf->len == 0)
+		return 0;
+
+	/* data must not overtake what is already queued, completion-based
+	 * conns always send from the queue */
+	if (!conn->writeq.head && !conn->uring) {
+		if (zerocopy) {
+			len = conn_send_zc_chunk(
+				conn, buf, buf->data, buf->len);
+			if (len < 0)
+				return -len;
+		} else {
+			do {
+				len = send(conn->fd,
+					   buf->data,
+					   buf->len,
+					   MSG_NOSIGNAL);
+			} while (len < 0 && errno == EINTR);
+
+			if (len < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					return errno;
+				len = 0;
+			}
+		}
+
+		if ((size_t)len == buf->len)
+			return 0;
+	}
+
+	/* the rest stays in the shared memory until the socket takes it */
+	struct neutron_conn_wbuf *wbuf =
+		malloc(sizeof(struct neutron_conn_wbuf));
+	if (!wbuf) {
+		LOG_ERRNO("Failed to allocate memory for pending data");
+		return ENOMEM;
+	}
+
+	wbuf->base = buf->data + len;
+	wbuf->len = buf->len - len;
+	wbuf->off = 0;
+	wbuf->shared = neutron_buf_ref(buf);
+	wbuf->next = NULL;
+
+	int was_empty = conn->writeq.head == NULL;
+	conn_writeq_push(conn, wbuf);
+	return conn_writeq_queued(conn, was_empty);
+}
+
+/* drops the buffers of the sends numbered lo to hi */
+static void
+conn_zc_complete(struct neutron_conn *conn, uint32_t lo, uint32_t hi)
+{
+	struct neutron_zc_pending **link = &conn->zc.head;
+	struct neutron_zc_pending *prev = NULL;
+
+	while (*link) {
+		struct neutron_zc_pending *pending = *link;
+
+		/* ids wrap around */
+		if ((uint32_t)(pending->id - lo) > (uint32_t)(hi - lo)) {
+			prev = pending;
+			link = &pending->next;
+			continue;
+		}
+
+		*link = pending->next;
+		if (conn->zc.tail == pending)
+			conn->zc.tail = prev;
+		neutron_buf_unref(pending->buf);
+		free(pending);
+	}
+}
+
+/* reads the zero-copy completions from the socket error queue, returns
+ * how many were found */
+static int conn_process_errqueue(struct neutron_conn *conn)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	uint8_t control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	int found = 0;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(conn->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP
+			      && cm->cmsg_type == IP_RECVERR)
+			    && !(cm->cmsg_level == SOL_IPV6
+				 && cm->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			struct sock_extended_err *ee =
+				(struct sock_extended_err *)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY
+			    || ee->ee_errno != 0)
+				continue;
+
+			/* one completion covers the range of sends
+			 * ee_info to ee_data */
+			uint64_t count =
+				(uint32_t)(ee->ee_data - ee->ee_info) + 1;
+			__atomic_add_fetch(&ctx->zc_stats.completions,
+					   count,
+					   __ATOMIC_RELAXED);
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				__atomic_add_fetch(&ctx->zc_stats.copied,
+						   count,
+						   __ATOMIC_RELAXED);
+
+			conn_zc_complete(conn, ee->ee_info, ee->ee_data);
+			found++;
+		}
+	}
+
+	return found;
 }
 
 static void conn_process_write(struct neutron_ctx *ctx,
 			       struct neutron_conn *conn)
 {
-	/* TODO */
+	struct iovec iov[CONN_WRITE_IOV_MAX];
+	struct msghdr msg;
+	ssize_t len;
+
+	while (conn->writeq.head) {
+		int iovcnt = 0;
+		struct neutron_conn_wbuf *wbuf = conn->writeq.head;
+		struct neutron_buf *zc = NULL;
+
+		if (wbuf->shared && wbuf->shared->zc_ctx && conn->zc.enabled)
+			zc = wbuf->shared;
+
+		/* flush as many chunks as possible per syscall, a zero-copy
+		 * chunk goes alone so that its completion maps to its buffer */
+		while (wbuf && iovcnt < CONN_WRITE_IOV_MAX) {
+			if (iovcnt > 0
+			    && (zc || (wbuf->shared && wbuf->shared->zc_ctx)))
+				break;
+			iov[iovcnt].iov_base = (void *)(wbuf->base + wbuf->off);
+			iov[iovcnt].iov_len = wbuf->len - wbuf->off;
+			iovcnt++;
+			wbuf = wbuf->next;
+		}
+
+		if (zc) {
+			len = conn_send_zc_chunk(
+				conn, zc, iov[0].iov_base, iov[0].iov_len);
+			if (len == 0)
+				break;
+			if (len < 0) {
+				errno = -len;
+				LOG_ERRNO("Failed to flush pending data");
+				conn->remove = 1;
+				return;
+			}
+		} else {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = iovcnt;
+
+			do {
+				len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+			} while (len < 0 && errno == EINTR);
+
+			if (len < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+				LOG_ERRNO("Failed to flush pending data");
+				conn->remove = 1;
+				return;
+			}
+		}
+
+		conn_writeq_consume(conn, len);
+	}
+
+	if (!conn->writeq.head)
+		conn_watch_write(conn, 0);
+
+	conn_writeq_drained(ctx, conn);
+}
+
+/* doubles the read buffer up to the ctx limit, returns 0 at the limit */
+static int conn_readbuf_grow(struct neutron_conn *conn)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	size_t capacity = conn->readbuf.capacity * 2;
+	size_t limit = ctx->readbuf_max_size;
+
+	/* a frame must fit whole */
+	if (ctx->frame.prefix != NEUTRON_FRAME_NONE
+	    && limit < ctx->frame.max_len + FRAME_PREFIX_MAX)
+		limit = ctx->frame.max_len + FRAME_PREFIX_MAX;
+
+	if (capacity > limit)
+		capacity = limit;
+	if (capacity <= conn->readbuf.capacity)
+		return 0;
+
+	uint8_t *data = realloc(conn->readbuf.data, capacity);
+	if (!data) {
+		LOG_ERRNO("Failed to grow readbuf in conn");
+		return 0;
+	}
+
+	conn->readbuf.data = data;
+	conn->readbuf.capacity = capacity;
+	return 1;
+}
+
+/* halves the read buffer once reads of len bytes stayed low for a while */
+static void conn_readbuf_adapt(struct neutron_conn *conn, size_t len)
+{
+	if (len > conn->readbuf.capacity / 4
+	    || conn->readbuf.capacity <= conn->ctx->readbuf_size) {
+		conn->readbuf.small_reads = 0;
+		return;
+	}
+
+	if (++conn->readbuf.small_reads < CONN_READBUF_SHRINK_READS)
+		return;
+	conn->readbuf.small_reads = 0;
+
+	size_t capacity = conn->readbuf.capacity / 2;
+	if (capacity < conn->ctx->readbuf_size)
+		capacity = conn->ctx->readbuf_size;
+	/* a partial frame is kept */
+	if (capacity < conn->readbuf.datalen)
+		return;
+
+	/* keep the larger buffer if it cannot be reallocated */
+	uint8_t *data = realloc(conn->readbuf.data, capacity);
+	if (data) {
+		conn->readbuf.data = data;
+		conn->readbuf.capacity = capacity;
+	}
+}
+
+static void conn_deliver(struct neutron_conn *conn, uint8_t *buf, size_t len)
+{
+	int ret = neutron_ctx_notify_event(conn->ctx, NEUTRON_EVENT_DATA, conn);
+	if (ret) {
+		LOG_ERRNO("Failed to notify msg event");
+		return;
+	}
+
+	if (conn->ctx->data_cb) {
+		(*conn->ctx->data_cb)(
+			conn->ctx, conn, buf, len, conn->ctx->userdata);
+	}
+}
+
+/* reads the length prefix at buf, returns 1 once it is complete, 0 while
+ * more bytes are needed and -1 if it is malformed */
+static int frame_parse_prefix(struct neutron_ctx *ctx,
+			      const uint8_t *buf,
+			      size_t len,
+			      size_t *prefixlen,
+			      uint64_t *framelen)
+{
+	uint64_t value = 0;
+
+	if (ctx->frame.prefix == NEUTRON_FRAME_FIXED) {
+		if (len < ctx->frame.size)
+			return 0;
+
+		/* network byte order */
+		for (uint32_t i = 0; i < ctx->frame.size; i++)
+			value = (value << 8) | buf[i];
+		*prefixlen = ctx->frame.size;
+		*framelen = value;
+		return 1;
+	}
+
+	/* LEB128: 7 bits per byte, least significant group first */
+	for (size_t i = 0; i < len; i++) {
+		if (i == FRAME_PREFIX_MAX)
+			return -1;
+
+		value |= (uint64_t)(buf[i] & 0x7f) << (7 * i);
+		if (!(buf[i] & 0x80)) {
+			*prefixlen = i + 1;
+			*framelen = value;
+			return 1;
+		}
+	}
+	return len < FRAME_PREFIX_MAX ? 0 : -1;
+}
+
+/* calls data_cb once per complete frame of the read buffer, in place, and
+ * moves the partial frame left to the start of the buffer */
+static void conn_process_frames(struct neutron_conn *conn)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	uint8_t *data = conn->readbuf.data;
+	size_t off = 0, prefixlen;
+	uint64_t framelen;
+
+	while (!conn->remove) {
+		size_t left = conn->readbuf.datalen - off;
+		int ret = frame_parse_prefix(
+			ctx, data + off, left, &prefixlen, &framelen);
+		if (ret == 0)
+			break;
+
+		if (ret < 0 || framelen > ctx->frame.max_len) {
+			LOGE("Invalid frame length on connection fd: %d",
+			     conn->fd);
+			conn->remove = 1;
+			return;
+		}
+
+		if (left - prefixlen < framelen)
+			break;
+
+		conn_deliver(conn, data + off + prefixlen, framelen);
+		off += prefixlen + framelen;
+	}
+
+	conn->readbuf.datalen -= off;
+	if (off && conn->readbuf.datalen)
+		memmove(data, data + off, conn->readbuf.datalen);
 }
 
 static void conn_process_read_stream(struct neutron_conn *conn)
 {
+	int framing = conn->ctx->frame.prefix != NEUTRON_FRAME_NONE;
+	size_t got;
+	ssize_t len;
+	int drained;
+
+	/* in edge-triggered mode keep reading until the socket is drained */
 	do {
-		conn->readbuf.datalen = read(
-			conn->fd, conn->readbuf.data, conn->readbuf.capacity);
-	} while (conn->readbuf.datalen < 0 && errno != EINTR);
+		/* with framing, a partial frame stays at the buffer start */
+		if (!framing)
+			conn->readbuf.datalen = 0;
+		got = 0;
+		drained = 0;
 
-	if (conn->readbuf.datalen > 0) {
-		int ret = neutron_ctx_notify_event(
-			conn->ctx, NEUTRON_EVENT_DATA, conn);
-		if (ret) {
-			LOG_ERRNO("Failed to notify msg event");
-			return;
+		/* fill the buffer, growing it while the socket keeps it full,
+		 * so that a burst costs one callback */
+		for (;;) {
+			if (conn->readbuf.datalen == conn->readbuf.capacity
+			    && !conn_readbuf_grow(conn))
+				break;
+
+			/* only the first read is known not to block */
+			do {
+				len = recv(conn->fd,
+					   conn->readbuf.data
+						   + conn->readbuf.datalen,
+					   conn->readbuf.capacity
+						   - conn->readbuf.datalen,
+					   got ? MSG_DONTWAIT : 0);
+			} while (len < 0 && errno == EINTR);
+
+			if (len < 0
+			    && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				drained = 1;
+				break;
+			}
+
+			if (len <= 0) {
+				conn->remove = 1;
+				break;
+			}
+
+			conn->readbuf.datalen += len;
+			got += len;
+
+			/* a short read emptied the socket */
+			if (conn->readbuf.datalen < conn->readbuf.capacity)
+				break;
+		}
+
+		if (got == 0)
+			break;
+
+		if (framing) {
+			conn_process_frames(conn);
+		} else {
+			conn_deliver(conn,
+				     conn->readbuf.data,
+				     conn->readbuf.datalen);
+		}
+
+		conn_readbuf_adapt(conn, got);
+	} while (conn->ctx->edge_triggered && !drained && !conn->remove);
+}
+
+/* session conn of the sender, NULL when the ctx keeps no sessions */
+static struct neutron_conn *conn_dgram_session(struct neutron_conn *conn,
+					       struct sockaddr_storage *ss,
+					       socklen_t sslen,
+					       uint64_t now_ns)
+{
+	if (!conn->ctx->sessions.enabled)
+		return NULL;
+
+	struct neutron_conn *session =
+		session_get(conn->ctx, conn, ss, sslen, now_ns);
+	return session ? session : conn;
+}
+
+static uint64_t conn_dgram_clock(struct neutron_conn *conn)
+{
+	return conn->ctx->sessions.enabled ? neutron_wheel_clock_ns() : 0;
+}
+
+/* the tail of a datagram larger than the buffer is lost, it is dropped
+ * rather than handed over cut */
+static void conn_dgram_truncated(struct neutron_conn *conn, size_t bufsize)
+{
+	LOGW("Dropped a datagram over %zu bytes on fd: %d", bufsize, conn->fd);
+}
+
+static void conn_process_read_dgram(struct neutron_conn *conn)
+{
+	ssize_t len;
+
+	do {
+		/* MSG_TRUNC returns the full length of the datagram */
+		do {
+			conn->peer_addrlen = sizeof(struct sockaddr_storage);
+			len = recvfrom(conn->fd,
+				       conn->readbuf.data,
+				       conn->readbuf.capacity,
+				       MSG_TRUNC,
+				       (struct sockaddr *)conn->peer,
+				       &conn->peer_addrlen);
+		} while (len < 0 && errno == EINTR);
+
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG_ERRNO("recvfrom");
+			break;
+		}
+
+		if ((size_t)len > conn->readbuf.capacity) {
+			conn_dgram_truncated(conn, conn->readbuf.capacity);
+			continue;
+		}
+
+		conn->readbuf.datalen = len;
+
+		struct neutron_conn *target =
+			conn_dgram_session(conn,
+					   conn->peer,
+					   conn->peer_addrlen,
+					   conn_dgram_clock(conn));
+		if (!target)
+			target = conn;
+
+		if (len > 0) {
+			int ret = neutron_ctx_notify_event(
+				conn->ctx, NEUTRON_EVENT_DATA, target);
+			if (ret) {
+				LOG_ERRNO("Failed to notify udp msg event");
+				return;
+			}
 		}
 
 		if (conn->ctx->data_cb) {
 			(*conn->ctx->data_cb)(conn->ctx,
-					      conn,
+					      target,
 					      conn->readbuf.data,
 					      conn->readbuf.datalen,
 					      conn->ctx->userdata);
 		}
-	} else {
-		conn->remove = 1;
+	} while (conn->ctx->edge_triggered);
+}
+
+static void conn_deliver_segments(struct neutron_conn *conn,
+				  struct neutron_conn *target,
+				  struct neutron_dgram *dgrams,
+				  uint32_t count)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+
+	if (ctx->dgram_batch_cb) {
+		(*ctx->dgram_batch_cb)(ctx, conn, dgrams, count, ctx->userdata);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count && ctx->data_cb; i++) {
+		(*ctx->data_cb)(ctx,
+				target,
+				dgrams[i].buf,
+				dgrams[i].len,
+				ctx->userdata);
 	}
 }
 
-static void conn_process_read_dgram(struct neutron_conn *conn)
+/* a read returns datagrams of one sender coalesced by the kernel, all of
+ * gso size but the last one */
+static void conn_process_read_dgram_gro(struct neutron_conn *conn)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct neutron_dgram dgrams[CONN_GRO_SEGMENTS];
+	struct neutron_addr peer = {.ss = conn->peer};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	if (conn->readbuf.capacity < CONN_GRO_BUF_SIZE) {
+		uint8_t *data = realloc(conn->readbuf.data, CONN_GRO_BUF_SIZE);
+		if (!data) {
+			LOG_ERRNO("Failed to grow readbuf in conn");
+			return;
+		}
+		conn->readbuf.data = data;
+		conn->readbuf.capacity = CONN_GRO_BUF_SIZE;
+	}
+
+	do {
+		struct iovec iov = {
+			.iov_base = conn->readbuf.data,
+			.iov_len = conn->readbuf.capacity,
+		};
+		struct msghdr msg = {
+			.msg_name = conn->peer,
+			.msg_namelen = sizeof(struct sockaddr_storage),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = control.buf,
+			.msg_controllen = sizeof(control.buf),
+		};
+
+		do {
+			len = recvmsg(conn->fd, &msg, 0);
+		} while (len < 0 && errno == EINTR);
+
+		if (len < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG_ERRNO("recvmsg");
+			break;
+		}
+
+		conn->peer_addrlen = msg.msg_namelen;
+		conn->readbuf.datalen = len;
+		peer.sslen = msg.msg_namelen;
+
+		size_t seg = len;
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			int gso;
+			if (cmsg->cmsg_level != SOL_UDP
+			    || cmsg->cmsg_type != UDP_GRO)
+				continue;
+			memcpy(&gso, CMSG_DATA(cmsg), sizeof(gso));
+			if (gso > 0)
+				seg = gso;
+		}
+
+		struct neutron_conn *session = conn_dgram_session(
+			conn, conn->peer, peer.sslen, conn_dgram_clock(conn));
+		struct neutron_conn *target = session ? session : conn;
+
+		if (len > 0) {
+			int ret = neutron_ctx_notify_event(
+				conn->ctx, NEUTRON_EVENT_DATA, target);
+			if (ret) {
+				LOG_ERRNO("Failed to notify udp msg event");
+				return;
+			}
+		}
+
+		size_t off = 0;
+		uint32_t count = 0;
+		do {
+			size_t seglen = len - off < seg ? len - off : seg;
+			dgrams[count].buf = conn->readbuf.data + off;
+			dgrams[count].len = seglen;
+			dgrams[count].addr = &peer;
+			dgrams[count].conn = session;
+			count++;
+			off += seglen;
+
+			if (count == CONN_GRO_SEGMENTS || off >= (size_t)len) {
+				conn_deliver_segments(
+					conn, target, dgrams, count);
+				count = 0;
+			}
+		} while (off < (size_t)len);
+	} while (conn->ctx->edge_triggered);
+}
+
+void conn_ring_free(struct neutron_conn *conn)
 {
+	free(conn->ring);
+	conn->ring = NULL;
+}
+
+static struct neutron_conn_ring *conn_ring_new(uint32_t count, size_t slotlen)
+{
+	/* every element size is a multiple of 8, the arrays stay aligned */
+	size_t size = sizeof(struct neutron_conn_ring)
+		      + count
+				* (sizeof(struct sockaddr_storage)
+				   + sizeof(struct mmsghdr)
+				   + sizeof(struct iovec)
+				   + sizeof(struct neutron_addr)
+				   + sizeof(struct neutron_dgram) + slotlen);
+
+	struct neutron_conn_ring *ring = calloc(1, size);
+	if (!ring) {
+		LOG_ERRNO("Failed to allocate memory for datagram ring");
+		return NULL;
+	}
+
+	ring->count = count;
+	ring->slotlen = slotlen;
+	ring->peers = (struct sockaddr_storage *)(ring + 1);
+	ring->msgs = (struct mmsghdr *)(ring->peers + count);
+	ring->iovs = (struct iovec *)(ring->msgs + count);
+	ring->addrs = (struct neutron_addr *)(ring->iovs + count);
+	ring->dgrams = (struct neutron_dgram *)(ring->addrs + count);
+	ring->data = (uint8_t *)(ring->dgrams + count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		ring->iovs[i].iov_base = ring->data + i * slotlen;
+		ring->msgs[i].msg_hdr.msg_iov = &ring->iovs[i];
+		ring->msgs[i].msg_hdr.msg_iovlen = 1;
+		ring->msgs[i].msg_hdr.msg_name = &ring->peers[i];
+		ring->addrs[i].ss = &ring->peers[i];
+		ring->dgrams[i].buf = ring->iovs[i].iov_base;
+		ring->dgrams[i].addr = &ring->addrs[i];
+	}
+	return ring;
+}
+
+static void conn_process_read_dgram_batch(struct neutron_conn *conn)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+	struct neutron_conn_ring *ring = conn->ring;
+	int count;
+
+	if (!ring || ring->count != ctx->dgram_batch
+	    || ring->slotlen != ctx->readbuf_size) {
+		conn_ring_free(conn);
+		ring = conn_ring_new(ctx->dgram_batch, ctx->readbuf_size);
+		if (!ring)
+			return;
+		conn->ring = ring;
+	}
+
 	do {
-		conn->readbuf.datalen = recvfrom(conn->fd,
-						 conn->readbuf.data,
-						 conn->readbuf.capacity,
-						 0,
-						 (struct sockaddr *)conn->peer,
-						 &conn->peer_addrlen);
-	} while (conn->readbuf.datalen < 0 && errno != EINTR);
-
-	if (conn->readbuf.datalen > 0) {
-		int ret = neutron_ctx_notify_event(
-			conn->ctx, NEUTRON_EVENT_DATA, conn);
+		for (uint32_t i = 0; i < ring->count; i++) {
+			ring->iovs[i].iov_len = ring->slotlen;
+			ring->msgs[i].msg_hdr.msg_namelen =
+				sizeof(struct sockaddr_storage);
+		}
+
+		do {
+			count = recvmmsg(conn->fd,
+					 ring->msgs,
+					 ring->count,
+					 MSG_DONTWAIT,
+					 NULL);
+		} while (count < 0 && errno == EINTR);
+
+		if (count <= 0) {
+			if (count < 0 && errno != EAGAIN
+			    && errno != EWOULDBLOCK)
+				LOG_ERRNO("recvmmsg");
+			break;
+		}
+
+		/* truncated datagrams are left out, the others move up */
+		uint64_t now = conn_dgram_clock(conn);
+		int kept = 0;
+		for (int i = 0; i < count; i++) {
+			struct msghdr *hdr = &ring->msgs[i].msg_hdr;
+			if (hdr->msg_flags & MSG_TRUNC) {
+				conn_dgram_truncated(conn, ring->slotlen);
+				continue;
+			}
+
+			struct neutron_dgram *dgram = &ring->dgrams[kept++];
+			ring->addrs[i].sslen = hdr->msg_namelen;
+			dgram->buf = ring->iovs[i].iov_base;
+			dgram->len = ring->msgs[i].msg_len;
+			dgram->addr = &ring->addrs[i];
+			dgram->conn = conn_dgram_session(
+				conn, &ring->peers[i], hdr->msg_namelen, now);
+		}
+		if (kept == 0)
+			continue;
+		count = kept;
+
+		/* replies on the conn go to the last sender */
+		conn->peer_addrlen = ring->dgrams[count - 1].addr->sslen;
+		memcpy(conn->peer,
+		       ring->dgrams[count - 1].addr->ss,
+		       conn->peer_addrlen);
+
+		int ret =
+			neutron_ctx_notify_event(ctx, NEUTRON_EVENT_DATA, conn);
 		if (ret) {
 			LOG_ERRNO("Failed to notify udp msg event");
 			return;
 		}
+
+		if (ctx->dgram_batch_cb) {
+			(*ctx->dgram_batch_cb)(
+				ctx, conn, ring->dgrams, count, ctx->userdata);
+			continue;
+		}
+
+		for (int i = 0; i < count && ctx->data_cb; i++) {
+			conn->peer_addrlen = ring->dgrams[i].addr->sslen;
+			memcpy(conn->peer,
+			       ring->dgrams[i].addr->ss,
+			       conn->peer_addrlen);
+			struct neutron_conn *target = ring->dgrams[i].conn;
+			(*ctx->data_cb)(ctx,
+					target ? target : conn,
+					ring->dgrams[i].buf,
+					ring->dgrams[i].len,
+					ctx->userdata);
+		}
+	} while (ctx->edge_triggered);
+}
+
+static void conn_uring_put(struct neutron_conn_uring *u)
+{
+	if (u->conn || u->inflight || u->recv.deferred || u->send.deferred)
+		return;
+
+	/* a cancel still waiting for room must not hit a later request */
+	neutron_uring_forget(u->loop, &u->recv);
+	neutron_uring_forget(u->loop, &u->send);
+	conn_wbufs_free(u->orphans);
+	free(u);
+}
+
+static int conn_uring_recv(struct neutron_conn_uring *u)
+{
+	int ret = neutron_uring_recv(u->loop, u->conn->fd, &u->recv);
+	if (ret)
+		return ret;
+
+	u->receiving = 1;
+	u->inflight++;
+	return 0;
+}
+
+/* frames may span receive buffers, they are put together in the read
+ * buffer */
+static void conn_uring_deliver(struct neutron_conn *conn,
+			       uint8_t *buf,
+			       size_t len)
+{
+	size_t got = len;
+
+	if (conn->ctx->frame.prefix == NEUTRON_FRAME_NONE) {
+		conn_deliver(conn, buf, len);
+		return;
 	}
 
-	if (conn->ctx->data_cb) {
-		(*conn->ctx->data_cb)(conn->ctx,
-				      conn,
-				      conn->readbuf.data,
-				      conn->readbuf.datalen,
-				      conn->ctx->userdata);
+	while (len > 0 && !conn->remove) {
+		if (conn->readbuf.datalen == conn->readbuf.capacity
+		    && !conn_readbuf_grow(conn)) {
+			LOGE("Frame does not fit on connection fd: %d",
+			     conn->fd);
+			conn->remove = 1;
+			return;
+		}
+
+		size_t n = conn->readbuf.capacity - conn->readbuf.datalen;
+		if (n > len)
+			n = len;
+		memcpy(conn->readbuf.data + conn->readbuf.datalen, buf, n);
+		conn->readbuf.datalen += n;
+		buf += n;
+		len -= n;
+
+		conn_process_frames(conn);
 	}
+
+	conn_readbuf_adapt(conn, got);
+}
+
+static void
+conn_uring_recv_cb(struct neutron_uring_op *op, int32_t res, uint32_t flags)
+{
+	struct neutron_conn_uring *u = CONN_URING(op, recv);
+	uint8_t *buf = neutron_uring_buf(u->loop, flags);
+
+	if (!(flags & IORING_CQE_F_MORE)) {
+		u->receiving = 0;
+		u->inflight--;
+	}
+
+	if (u->conn && res > 0 && buf) {
+		conn_uring_deliver(u->conn, buf, res);
+	} else if (u->conn && res != -ENOBUFS) {
+		/* 0 is the end of the stream */
+		if (res < 0) {
+			errno = -res;
+			LOG_ERRNO("Failed to receive on connection");
+		}
+		u->conn->remove = 1;
+	}
+	neutron_uring_buf_put(u->loop, flags);
+
+	/* released from a callback */
+	struct neutron_conn *conn = u->conn;
+	if (!conn) {
+		conn_uring_put(u);
+		return;
+	}
+
+	/* ended by the kernel, e.g. out of buffers */
+	if (!conn->remove && !u->receiving && conn_uring_recv(u))
+		conn->remove = 1;
+
+	if (conn->remove)
+		neutron_ctx_remove_conn(conn->ctx, conn);
+}
+
+static void
+conn_uring_send_cb(struct neutron_uring_op *op, int32_t res, uint32_t flags)
+{
+	struct neutron_conn_uring *u = CONN_URING(op, send);
+	struct neutron_conn *conn = u->conn;
+
+	(void)flags;
+	u->sending = 0;
+	u->inflight--;
+
+	if (!conn) {
+		conn_uring_put(u);
+		return;
+	}
+
+	if (res < 0) {
+		errno = -res;
+		LOG_ERRNO("Failed to flush pending data");
+		conn->remove = 1;
+	} else {
+		conn_writeq_consume(conn, res);
+		conn_writeq_drained(conn->ctx, conn);
+		conn = u->conn;
+		if (conn && conn_uring_flush(conn))
+			conn->remove = 1;
+	}
+
+	if (conn && conn->remove)
+		neutron_ctx_remove_conn(conn->ctx, conn);
+}
+
+int conn_uring_start(struct neutron_conn *conn)
+{
+	struct neutron_ctx *ctx = conn->ctx;
+
+	if (ctx->type == NEUTRON_DGRAM || conn->zc.enabled
+	    || !neutron_uring_ops_supported(ctx->loop))
+		return ENOTSUP;
+
+	struct neutron_conn_uring *u =
+		calloc(1, sizeof(struct neutron_conn_uring));
+	if (!u) {
+		LOG_ERRNO("Failed to allocate memory for io_uring requests");
+		return ENOMEM;
+	}
+
+	u->recv.cb = conn_uring_recv_cb;
+	u->send.cb = conn_uring_send_cb;
+	u->conn = conn;
+	u->loop = ctx->loop;
+
+	int ret = conn_uring_recv(u);
+	if (ret) {
+		free(u);
+		return ret;
+	}
+
+	conn->uring = u;
+	return 0;
+}
+
+void conn_uring_release(struct neutron_conn *conn)
+{
+	struct neutron_conn_uring *u = conn->uring;
+
+	if (!u)
+		return;
+
+	conn->uring = NULL;
+	u->conn = NULL;
+
+	/* the kernel may still read the queue head */
+	if (u->sending) {
+		u->orphans = conn->writeq.head;
+		conn->writeq.head = NULL;
+		conn->writeq.tail = NULL;
+		conn->writeq.pending = 0;
+	}
+
+	/* requests that never reached the kernel get no completion */
+	if (u->receiving && neutron_uring_cancel(u->loop, &u->recv)) {
+		u->receiving = 0;
+		u->inflight--;
+	}
+	if (u->sending && neutron_uring_cancel(u->loop, &u->send)) {
+		u->sending = 0;
+		u->inflight--;
+	}
+
+	conn_uring_put(u);
 }
 
 static void conn_process_read(struct neutron_ctx *ctx,
 			      struct neutron_conn *conn)
 {
-	if (ctx->type == NEUTRON_DGRAM)
+	if (ctx->type == NEUTRON_DGRAM && ctx->udp.gro)
+		conn_process_read_dgram_gro(conn);
+	else if (ctx->type == NEUTRON_DGRAM && ctx->dgram_batch > 1)
+		conn_process_read_dgram_batch(conn);
+	else if (ctx->type == NEUTRON_DGRAM)
 		conn_process_read_dgram(conn);
 	else
 		conn_process_read_stream(conn);
@@ -123,13 +1425,27 @@ static void conn_process_read(struct neutron_ctx *ctx,
 
 void conn_cb(int fd, uint32_t revents, void *userdata)
 {
-	struct neutron_ctx *ctx = (struct neutron_ctx *)userdata;
-	struct neutron_conn *conn = neutron_ctx_find_connection(ctx, fd);
+	struct neutron_conn *conn = (struct neutron_conn *)userdata;
+
+	if (!conn)
+		return;
 
+	struct neutron_ctx *ctx = conn->ctx;
+	int completions = 0;
+
+	/* zero-copy completions are reported as an error on the socket */
+	if (conn->zc.enabled && (revents & NEUTRON_FD_EVENT_ERROR))
+		completions = conn_process_errqueue(conn);
+
+	if (!conn->remove && (revents & NEUTRON_FD_EVENT_OUT))
+		conn_process_write(ctx, conn);
 	if (!conn->remove && (revents & NEUTRON_FD_EVENT_IN))
 		conn_process_read(ctx, conn);
-	else if (!conn->remove && (revents & NEUTRON_FD_EVENT_OUT))
-		conn_process_write(ctx, conn);
-	else if (conn->remove || NEUTRON_FD_EVENT_ERROR)
+	if (!(revents & (NEUTRON_FD_EVENT_IN | NEUTRON_FD_EVENT_OUT))
+	    && !completions)
+		conn->remove = 1;
+
+	/* an edge-triggered fd will not report the hangup again */
+	if (conn->remove)
 		neutron_ctx_remove_conn(ctx, conn);
 }
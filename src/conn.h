@@ -3,12 +3,75 @@
 
 #include <neutron_priv.h>
 #include <neutron.h>
+#include <buf.h>
+#include <uring.h>
+
+#define CONN_WRITE_HIGH_WATERMARK (1024 * 1024)
+#define CONN_WRITE_LOW_WATERMARK (256 * 1024)
+#define CONN_WRITE_IOV_MAX 64
+#define CONN_READBUF_SIZE 512
+#define CONN_READBUF_MAX_SIZE (64 * 1024)
+/* consecutive reads using a quarter of the buffer before it shrinks */
+#define CONN_READBUF_SHRINK_READS 8
+#define CONN_POOL_MAX 64
+/* longest varint length prefix */
+#define FRAME_PREFIX_MAX 10
+
+#define CONN_GRO_BUF_SIZE (64 * 1024)
+#define CONN_GRO_SEGMENTS 64
+
+/* zero-copy send waiting for its kernel completion */
+struct neutron_zc_pending {
+	struct neutron_zc_pending *next;
+	uint32_t id;
+	struct neutron_buf *buf;
+};
+
+/* receive ring of a batched datagram conn, in a single allocation */
+struct neutron_conn_ring {
+	uint32_t count;
+	size_t slotlen;
+	struct sockaddr_storage *peers;
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	struct neutron_addr *addrs;
+	struct neutron_dgram *dgrams;
+	uint8_t *data;
+};
+
+/* chunk of outbound data that the socket did not take yet */
+struct neutron_conn_wbuf {
+	struct neutron_conn_wbuf *next;
+	size_t len;
+	size_t off;
+	/* data, or the memory of a shared buffer */
+	const uint8_t *base;
+	struct neutron_buf *shared;
+	uint8_t data[];
+};
+
+/* completion-based io of a stream conn on an io_uring loop, freed by the
+ * last completion once the conn was released */
+struct neutron_conn_uring {
+	struct neutron_uring_op recv, send;
+	struct neutron_conn *conn;
+	struct neutron_loop *loop;
+	uint32_t inflight;
+	uint8_t receiving, sending;
+
+	/* one sendmsg of the queue head at a time */
+	struct msghdr msg;
+	struct iovec iov[CONN_WRITE_IOV_MAX];
+	/* queue of a released conn, the send in flight still points into it */
+	struct neutron_conn_wbuf *orphans;
+};
 
 struct neutron_conn {
 	struct {
 		uint8_t *data;
 		size_t datalen;
 		size_t capacity;
+		uint32_t small_reads;
 	} readbuf;
 
 	int type;
@@ -17,20 +80,95 @@ struct neutron_conn {
 
 	uint8_t remove;
 
+	/* NEUTRON_FD_EVENT_OUT is only polled while data is pending */
+	struct {
+		struct neutron_conn_wbuf *head, *tail;
+		size_t pending;
+		/* high watermark was reported, low one not yet */
+		uint8_t throttled;
+	} writeq;
+
+	/* SO_ZEROCOPY is set, the kernel numbers zero-copy sends from 0 */
+	struct {
+		uint8_t enabled;
+		uint32_t next_id;
+		struct neutron_zc_pending *head, *tail;
+	} zc;
+
 	struct sockaddr_storage *local, *peer;
 	socklen_t local_addlren, peer_addrlen;
+	struct sockaddr_storage local_ss, peer_ss;
+
+	/* allocated on the first batched read */
+	struct neutron_conn_ring *ring;
+
+	/* set when the loop completes accept, recv and send instead of
+	 * polling the fd */
+	struct neutron_conn_uring *uring;
 
-	struct neutron_conn *next;
+	/* peer session of a datagram ctx, see session.h */
+	struct {
+		uint32_t hash;
+		uint64_t active_ns;
+		struct neutron_conn *chain;
+		struct neutron_conn *older, *newer;
+	} session;
+
+	void *userdata;
+
+	/* doubly linked so that a conn unlinks itself in constant time */
+	struct neutron_conn *prev, *next;
 
 	struct neutron_ctx *ctx;
 };
 
-struct neutron_conn *neutron_conn_new(int capacity);
+struct neutron_conn *neutron_conn_new(size_t capacity);
 
 void neutron_conn_destroy(struct neutron_conn *conn);
 
+/* pooled conn with a read buffer of the ctx size */
+struct neutron_conn *conn_pool_get(struct neutron_ctx *ctx);
+
+/* closes the conn and keeps it for reuse while the pool has room */
+void conn_pool_put(struct neutron_ctx *ctx, struct neutron_conn *conn);
+
+int conn_pool_prewarm(struct neutron_ctx *ctx, uint32_t count);
+
+void conn_pool_clear(struct neutron_ctx *ctx);
+
 int neutron_ctx_remove_conn(struct neutron_ctx *ctx, struct neutron_conn *conn);
 
 void conn_cb(int fd, uint32_t revents, void *userdata);
 
+/* Sends what the socket takes right away and queues the rest behind any
+ * pending data */
+int conn_send(struct neutron_conn *conn, const uint8_t *buf, size_t buflen);
+
+int conn_sendv(struct neutron_conn *conn, const struct iovec *iov, int iovcnt);
+
+/* Sends one datagram to the last peer the conn received from, datagrams
+ * are never queued */
+int conn_sendv_dgram(struct neutron_conn *conn,
+		     const struct iovec *iov,
+		     int iovcnt);
+
+void conn_writeq_clear(struct neutron_conn *conn);
+
+void conn_ring_free(struct neutron_conn *conn);
+
+int conn_enable_zerocopy(struct neutron_conn *conn);
+
+/* Sends a shared buffer, queuing the rest by reference. Zero-copy buffers
+ * use MSG_ZEROCOPY on conns with SO_ZEROCOPY. */
+int conn_send_buf(struct neutron_conn *conn, struct neutron_buf *buf);
+
+void conn_zc_clear(struct neutron_conn *conn);
+
+/* Receives and sends through io_uring completions, ENOTSUP when the conn
+ * must be polled: epoll loops, datagrams and zero-copy sends. */
+int conn_uring_start(struct neutron_conn *conn);
+
+/* detaches the conn from its requests, which are cancelled */
+void conn_uring_release(struct neutron_conn *conn);
+
 #endif
@@ -1,47 +1,118 @@
 #include <ctx.h>
 #include <conn.h>
 #include <loop.h>
+#include <group.h>
+
+/* the conns, pools and fds of the shards belong to the loop threads while
+ * the group runs */
+static int ctx_shards_running(struct neutron_ctx *ctx)
+{
+	return ctx->group && group_running(ctx->group);
+}
 
 static void neutron_ctx_add_conn(struct neutron_ctx *ctx,
 				 struct neutron_conn *conn)
 {
-	if (!ctx->head) {
+	conn->prev = ctx->tail;
+	conn->next = NULL;
+
+	if (ctx->tail)
+		ctx->tail->next = conn;
+	else
 		ctx->head = conn;
-		return;
-	}
+	ctx->tail = conn;
+}
 
-	struct neutron_conn *aux = ctx->head;
-	while (aux->next)
-		aux = aux->next;
+static void neutron_ctx_unlink_conn(struct neutron_ctx *ctx,
+				    struct neutron_conn *conn)
+{
+	if (conn->prev)
+		conn->prev->next = conn->next;
+	else
+		ctx->head = conn->next;
+
+	if (conn->next)
+		conn->next->prev = conn->prev;
+	else
+		ctx->tail = conn->prev;
+
+	conn->prev = NULL;
+	conn->next = NULL;
+}
 
-	aux->next = conn;
+uint32_t neutron_ctx_conn_events(struct neutron_ctx *ctx)
+{
+	uint32_t events = NEUTRON_FD_EVENT_IN;
+	if (ctx->edge_triggered)
+		events |= NEUTRON_FD_EVENT_ET;
+	return events;
 }
 
-static int server_accept_conn(int server_fd, struct neutron_ctx *ctx)
+int neutron_ctx_prepare_conn_fd(struct neutron_ctx *ctx, int fd)
 {
-	int ret = 0, conn_fd = -1;
+	/* a slow peer must not block the loop in send, and edge-triggered fds
+	 * are drained until EAGAIN */
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		LOG_ERRNO("Failed to set connection fd non-blocking");
+		return errno;
+	}
+	return 0;
+}
 
-	conn_fd = accept(server_fd,
-			 (struct sockaddr *)ctx->socket.addr,
-			 &ctx->socket.addrlen);
+/* hands the conn to the loop: io_uring completions where possible, fd
+ * polling otherwise */
+static int ctx_watch_conn(struct neutron_ctx *ctx, struct neutron_conn *conn)
+{
+	int ret = conn_uring_start(conn);
+	if (ret != ENOTSUP)
+		return ret;
 
-	if (conn_fd < 0) {
-		ret = errno;
-		LOG_ERRNO("Failed to accept connection");
-		goto cleanup;
+	return neutron_loop_add(ctx->loop,
+				conn->fd,
+				conn_cb,
+				neutron_ctx_conn_events(ctx),
+				conn);
+}
+
+/* takes an accepted fd, peer is NULL when the accept did not fill it */
+static int server_attach_conn(struct neutron_ctx *ctx,
+			      int conn_fd,
+			      const struct sockaddr_storage *peer,
+			      socklen_t peer_addrlen)
+{
+	int ret;
+
+	struct neutron_conn *conn = conn_pool_get(ctx);
+	if (!conn) {
+		close(conn_fd);
+		return ENOMEM;
 	}
 
-	struct neutron_conn *conn = neutron_conn_new(512);
 	conn->fd = conn_fd;
 	conn->ctx = ctx;
+	if (peer) {
+		memcpy(conn->peer, peer, peer_addrlen);
+		conn->peer_addrlen = peer_addrlen;
+	} else {
+		conn->peer_addrlen = sizeof(*conn->peer);
+		if (getpeername(conn_fd,
+				(struct sockaddr *)conn->peer,
+				&conn->peer_addrlen))
+			conn->peer_addrlen = 0;
+	}
 	neutron_ctx_add_conn(ctx, conn);
 
-	ret = neutron_loop_add(
-		ctx->loop, conn_fd, conn_cb, NEUTRON_FD_EVENT_IN, ctx);
+	if (ctx->zc_release_cb)
+		conn_enable_zerocopy(conn);
 
+	ret = ctx_watch_conn(ctx, conn);
 	if (ret) {
 		LOG_ERRNO("Failed to add connection fd to event loop");
-		goto cleanup;
+		neutron_ctx_unlink_conn(ctx, conn);
+		/* closes conn_fd */
+		conn_pool_put(ctx, conn);
+		return ret;
 	}
 
 	ret = neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECTED, conn);
@@ -51,12 +122,133 @@ static int server_accept_conn(int server_fd, struct neutron_ctx *ctx)
 	}
 
 	return 0;
+}
 
-cleanup:
-	if (conn_fd > 0)
-		close(conn_fd);
+static int server_accept_conn(int server_fd, struct neutron_ctx *ctx)
+{
+	int ret = 0, conn_fd = -1;
+	struct sockaddr_storage peer;
+	socklen_t peer_addrlen = sizeof(peer);
+
+	/* do not accept into ctx->socket.addr: it is the listen address and
+	 * may be shared by the listeners of a loop group */
+	do {
+		conn_fd = accept4(server_fd,
+				  (struct sockaddr *)&peer,
+				  &peer_addrlen,
+				  SOCK_NONBLOCK | SOCK_CLOEXEC);
+	} while (conn_fd < 0 && (errno == EINTR || errno == ECONNABORTED));
 
-	return ret;
+	if (conn_fd < 0) {
+		ret = errno;
+		if (ret != EAGAIN && ret != EWOULDBLOCK)
+			LOG_ERRNO("Failed to accept connection");
+		return ret;
+	}
+
+	return server_attach_conn(ctx, conn_fd, &peer, peer_addrlen);
+}
+
+static int ctx_accept_arm(struct neutron_ctx_accept *accept)
+{
+	int ret = neutron_uring_accept(
+		accept->loop, accept->ctx->socket.fd, &accept->op);
+	if (ret)
+		return ret;
+
+	accept->armed = 1;
+	return 0;
+}
+
+/* frees a detached accept once its last completion came */
+static void ctx_accept_free(struct neutron_ctx_accept *accept)
+{
+	if (accept->armed || accept->op.deferred)
+		return;
+
+	neutron_uring_forget(accept->loop, &accept->op);
+	free(accept);
+}
+
+static void
+ctx_accept_cb(struct neutron_uring_op *op, int32_t res, uint32_t flags)
+{
+	struct neutron_ctx_accept *accept = (struct neutron_ctx_accept *)op;
+	struct neutron_ctx *ctx = accept->ctx;
+	uint64_t accepted = 0, failed = 0;
+
+	if (!(flags & IORING_CQE_F_MORE))
+		accept->armed = 0;
+
+	/* the listener was closed */
+	if (!ctx) {
+		if (res >= 0)
+			close(res);
+		ctx_accept_free(accept);
+		return;
+	}
+
+	if (res >= 0) {
+		if (server_attach_conn(ctx, res, NULL, 0))
+			failed++;
+		else
+			accepted++;
+	} else if (res != -ECANCELED) {
+		errno = -res;
+		LOG_ERRNO("Failed to accept connection");
+		failed++;
+	}
+
+	__atomic_add_fetch(&ctx->accept_stats.wakeups, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(
+		&ctx->accept_stats.accepted, accepted, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->accept_stats.failed, failed, __ATOMIC_RELAXED);
+
+	/* the kernel ends a multishot accept on errors */
+	if (ctx->accept == accept && !accept->armed && ctx_accept_arm(accept))
+		LOGE("Failed to accept connections again");
+}
+
+/* multishot accept instead of polling the listener, ENOTSUP on loops
+ * that poll */
+static int ctx_accept_start(struct neutron_ctx *ctx)
+{
+	if (!neutron_uring_ops_supported(ctx->loop))
+		return ENOTSUP;
+
+	struct neutron_ctx_accept *accept =
+		calloc(1, sizeof(struct neutron_ctx_accept));
+	if (!accept) {
+		LOG_ERRNO("Failed to allocate memory for io_uring accept");
+		return ENOMEM;
+	}
+
+	accept->op.cb = ctx_accept_cb;
+	accept->ctx = ctx;
+	accept->loop = ctx->loop;
+
+	int ret = ctx_accept_arm(accept);
+	if (ret) {
+		free(accept);
+		return ret;
+	}
+
+	ctx->accept = accept;
+	return 0;
+}
+
+static void ctx_accept_stop(struct neutron_ctx *ctx)
+{
+	struct neutron_ctx_accept *accept = ctx->accept;
+
+	if (!accept)
+		return;
+
+	ctx->accept = NULL;
+	accept->ctx = NULL;
+	if (accept->armed && neutron_uring_cancel(accept->loop, &accept->op))
+		accept->armed = 0;
+	ctx_accept_free(accept);
 }
 
 int neutron_ctx_notify_event(struct neutron_ctx *ctx,
@@ -83,21 +275,13 @@ int neutron_ctx_notify_event(struct neutron_ctx *ctx,
 void neutron_conn_destroy(struct neutron_conn *conn)
 {
 	if (conn) {
+		conn_uring_release(conn);
+
 		if (conn->readbuf.data) {
 			free(conn->readbuf.data);
 			conn->readbuf.data = NULL;
 		}
 
-		if (conn->local) {
-			free(conn->local);
-			conn->local = NULL;
-		}
-
-		if (conn->peer) {
-			free(conn->peer);
-			conn->peer = NULL;
-		}
-
 		if (conn->fd > 0) {
 			close(conn->fd);
 			conn->fd = -1;
@@ -106,6 +290,10 @@ void neutron_conn_destroy(struct neutron_conn *conn)
 		conn->readbuf.capacity = 0;
 		conn->readbuf.datalen = 0;
 
+		conn_ring_free(conn);
+		conn_zc_clear(conn);
+		conn_writeq_clear(conn);
+
 		free(conn);
 		conn = NULL;
 	}
@@ -127,6 +315,14 @@ struct neutron_ctx *neutron_ctx_create_with_loop(neutron_ctx_event_cb cb,
 	ctx->loop = loop;
 	ctx->userdata = userdata;
 	ctx->ext_loop = 1;
+	ctx->backlog = CTX_LISTEN_BACKLOG;
+	ctx->accept_batch = CTX_ACCEPT_BATCH;
+	ctx->write_high_watermark = CONN_WRITE_HIGH_WATERMARK;
+	ctx->write_low_watermark = CONN_WRITE_LOW_WATERMARK;
+	ctx->readbuf_size = CONN_READBUF_SIZE;
+	ctx->readbuf_max_size = CONN_READBUF_MAX_SIZE;
+	ctx->pool.max = CONN_POOL_MAX;
+	ctx->dgram_batch = 1;
 	return ctx;
 
 cleanup:
@@ -161,6 +357,47 @@ cleanup:
 	return NULL;
 }
 
+struct neutron_ctx *
+neutron_ctx_create_with_group(neutron_ctx_event_cb cb,
+			      struct neutron_loop_group *group,
+			      void *userdata)
+{
+	uint32_t count = neutron_loop_group_get_count(group);
+	if (count == 0) {
+		LOGE("Failure: loop group is null or empty");
+		return NULL;
+	}
+
+	struct neutron_ctx *ctx = neutron_ctx_create_with_loop(
+		cb, neutron_loop_group_get_loop(group, 0), userdata);
+	if (!ctx)
+		return NULL;
+
+	ctx->shards = calloc(count, sizeof(struct neutron_ctx *));
+	if (!ctx->shards) {
+		LOG_ERRNO("Failed to allocate memory for ctx shards");
+		goto cleanup;
+	}
+	ctx->nshards = count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		ctx->shards[i] = neutron_ctx_create_with_loop(
+			cb, neutron_loop_group_get_loop(group, i), userdata);
+		if (!ctx->shards[i]) {
+			LOGE("Failed to create ctx shard %u", i);
+			goto cleanup;
+		}
+		ctx->shards[i]->reuseport = 1;
+	}
+	ctx->group = group;
+
+	return ctx;
+
+cleanup:
+	neutron_ctx_destroy(ctx);
+	return NULL;
+}
+
 struct neutron_loop *neutron_ctx_get_loop(struct neutron_ctx *ctx)
 {
 	if (!ctx) {
@@ -190,7 +427,10 @@ struct neutron_addr *neutron_addr_parse(const char *address)
 		goto cleanup;
 	}
 
-	char *addr_body = strtok(NULL, ":");
+	/* the colons of a bracketed IPv6 address are not separators */
+	size_t off = protocol - address_cpy + strlen(protocol);
+	char *addr_body = strtok(
+		NULL, address[off] && address[off + 1] == '[' ? "[]" : ":");
 	if (!addr_body) {
 		LOGE("Address format incorrect: failed to parse address");
 		goto cleanup;
@@ -283,6 +523,8 @@ int neutron_ctx_set_socket_data_cb(struct neutron_ctx *ctx,
 		return EINVAL;
 
 	ctx->data_cb = cb;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->data_cb = cb;
 	return 0;
 }
 
@@ -292,6 +534,8 @@ int neutron_ctx_set_socket_fd_cb(struct neutron_ctx *ctx, neutron_ctx_fd_cb cb)
 		return EINVAL;
 
 	ctx->fd_cb = cb;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->fd_cb = cb;
 	return 0;
 }
 
@@ -302,179 +546,1072 @@ int neutron_ctx_set_socket_event_cb(struct neutron_ctx *ctx,
 		return EINVAL;
 
 	ctx->event_cb = cb;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->event_cb = cb;
 	return 0;
 }
 
 struct neutron_conn *neutron_ctx_find_connection(struct neutron_ctx *ctx,
 						 int fd)
 {
-	if (ctx->head->fd == fd)
-		return ctx->head;
-
-	struct neutron_conn *aux = ctx->head;
-	while (aux->next && aux->next->fd != fd)
-		aux = aux->next;
+	/* connection fds are registered with the conn as loop userdata */
+	struct neutron_fd *nfd = neutron_loop_find_fd(ctx->loop, fd);
+	if (!nfd || nfd->cb != conn_cb)
+		return NULL;
 
-	return aux->next;
+	struct neutron_conn *conn = (struct neutron_conn *)nfd->userdata;
+	return conn->ctx == ctx ? conn : NULL;
 }
 
-int neutron_ctx_listen(struct neutron_ctx *ctx, struct neutron_addr *addr)
+int neutron_ctx_set_edge_triggered(struct neutron_ctx *ctx, int enable)
 {
-	int ret, opt = 1;
-
-	if (!ctx || !addr || !addr->ss)
+	if (!ctx)
 		return EINVAL;
 
-	ctx->type = NEUTRON_SERVER;
+	ctx->edge_triggered = enable ? 1 : 0;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->edge_triggered = ctx->edge_triggered;
+	return 0;
+}
 
-	ctx->socket.addr = addr->ss;
-	ctx->socket.addrlen = addr->sslen;
-	ctx->socket.type = addr->ss->ss_family;
-	ctx->socket.fd = socket(ctx->socket.type, SOCK_STREAM, 0);
+int neutron_ctx_set_listen_backlog(struct neutron_ctx *ctx, int backlog)
+{
+	if (!ctx || backlog <= 0)
+		return EINVAL;
 
-	if (ctx->socket.fd < 0) {
-		LOG_ERRNO("Failed to create socket fd");
-		return errno;
+	ctx->backlog = backlog;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		int ret = neutron_ctx_set_listen_backlog(ctx->shards[i], backlog);
+		if (ret)
+			return ret;
 	}
 
-	if (ctx->fd_cb)
-		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
-
-	ret = setsockopt(
-		ctx->socket.fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-	if (ret) {
-		LOG_ERRNO("Failed to setsockopt");
-		return ret;
+	/* listen() on a listening socket only updates its backlog */
+	if (ctx->type == NEUTRON_SERVER && ctx->socket.fd > 0) {
+		if (listen(ctx->socket.fd, backlog) < 0) {
+			LOG_ERRNO("Failed to update listen backlog");
+			return errno;
+		}
 	}
+	return 0;
+}
 
-	ret = bind(ctx->socket.fd,
-		   (struct sockaddr *)ctx->socket.addr,
-		   ctx->socket.addrlen);
-	if (ret) {
-		LOG_ERRNO("Failed to bind socket");
-		return ret;
-	}
+int neutron_ctx_set_write_watermarks(struct neutron_ctx *ctx,
+				     size_t low,
+				     size_t high)
+{
+	if (!ctx || low > high)
+		return EINVAL;
 
-	ret = listen(ctx->socket.fd, MAX_SERVER_CONNECTIONS);
-	if (ret) {
-		LOG_ERRNO("Failed to start listening");
-		return ret;
+	ctx->write_low_watermark = low;
+	ctx->write_high_watermark = high;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ctx->shards[i]->write_low_watermark = low;
+		ctx->shards[i]->write_high_watermark = high;
 	}
+	return 0;
+}
 
-	ret = neutron_loop_add(ctx->loop,
-			       ctx->socket.fd,
-			       listen_cb,
-			       NEUTRON_FD_EVENT_IN,
-			       (void *)ctx);
+int neutron_ctx_set_read_buffer(struct neutron_ctx *ctx,
+				size_t size,
+				size_t max_size)
+{
+	if (!ctx || size == 0 || max_size < size)
+		return EINVAL;
 
-	if (ret) {
-		LOG_ERRNO("Failed to register socket fd in event loop");
-		return ret;
+	ctx->readbuf_size = size;
+	ctx->readbuf_max_size = max_size;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ctx->shards[i]->readbuf_size = size;
+		ctx->shards[i]->readbuf_max_size = max_size;
 	}
+	return 0;
+}
+
+int neutron_ctx_set_dgram_batch(struct neutron_ctx *ctx,
+				uint32_t count,
+				neutron_ctx_dgram_batch_cb cb)
+{
+	if (!ctx || count == 0)
+		return EINVAL;
 
+	ctx->dgram_batch = count;
+	ctx->dgram_batch_cb = cb;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ctx->shards[i]->dgram_batch = count;
+		ctx->shards[i]->dgram_batch_cb = cb;
+	}
 	return 0;
 }
 
-void listen_cb(int server_fd, uint32_t revents, void *userdata)
+static int ctx_apply_udp_gro(struct neutron_ctx *ctx)
 {
-	server_accept_conn(server_fd, userdata);
+	int opt = ctx->udp.gro;
+	int ret = setsockopt(
+		ctx->socket.fd, SOL_UDP, UDP_GRO, &opt, sizeof(opt));
+	if (ret) {
+		LOG_ERRNO("Failed to setsockopt UDP_GRO");
+		return errno;
+	}
+	return 0;
 }
 
-int neutron_ctx_connect(struct neutron_ctx *ctx, struct neutron_addr *addr)
+int neutron_ctx_set_dgram_sessions(struct neutron_ctx *ctx,
+				   int enable,
+				   uint32_t idle_ms)
 {
-	int ret = 0;
+	int ret;
 
-	if (!ctx) {
-		LOGE("Failure: ctx is null");
+	if (!ctx)
 		return EINVAL;
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ret = neutron_ctx_set_dgram_sessions(
+			ctx->shards[i], enable, idle_ms);
+		if (ret)
+			return ret;
 	}
-	ctx->type = NEUTRON_CLIENT;
 
-	if (!addr || !addr->ss) {
-		LOGE("Failure: cannot connect to null address");
-		return EINVAL;
+	if (!enable) {
+		session_clear(ctx, 1);
+		ctx->sessions.enabled = 0;
+		return 0;
 	}
-	ctx->socket.addr = addr->ss;
-	ctx->socket.addrlen = addr->sslen;
-	ctx->socket.type = addr->ss->ss_family;
+	return session_enable(ctx, idle_ms);
+}
 
-	ctx->socket.fd = socket(ctx->socket.type, SOCK_STREAM, 0);
-	if (ctx->socket.fd < 0) {
-		LOG_ERRNO("Failed to create client socket");
+static int ctx_apply_multicast(struct neutron_ctx *ctx)
+{
+	int family = 0;
+	socklen_t len = sizeof(family);
+	int ret = getsockopt(
+		ctx->socket.fd, SOL_SOCKET, SO_DOMAIN, &family, &len);
+	if (ret) {
+		LOG_ERRNO("Failed to getsockopt SO_DOMAIN");
 		return errno;
 	}
 
-	if (ctx->fd_cb) {
-		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
+	if (family == AF_INET6) {
+		int ifindex = ctx->mcast.ifindex;
+		ret = setsockopt(ctx->socket.fd,
+				 IPPROTO_IPV6,
+				 IPV6_MULTICAST_HOPS,
+				 &ctx->mcast.ttl,
+				 sizeof(int))
+		      || setsockopt(ctx->socket.fd,
+				    IPPROTO_IPV6,
+				    IPV6_MULTICAST_LOOP,
+				    &ctx->mcast.loop,
+				    sizeof(int))
+		      || setsockopt(ctx->socket.fd,
+				    IPPROTO_IPV6,
+				    IPV6_MULTICAST_IF,
+				    &ifindex,
+				    sizeof(int));
+	} else {
+		struct ip_mreqn mreqn = {.imr_ifindex = ctx->mcast.ifindex};
+		ret = setsockopt(ctx->socket.fd,
+				 IPPROTO_IP,
+				 IP_MULTICAST_TTL,
+				 &ctx->mcast.ttl,
+				 sizeof(int))
+		      || setsockopt(ctx->socket.fd,
+				    IPPROTO_IP,
+				    IP_MULTICAST_LOOP,
+				    &ctx->mcast.loop,
+				    sizeof(int))
+		      || setsockopt(ctx->socket.fd,
+				    IPPROTO_IP,
+				    IP_MULTICAST_IF,
+				    &mreqn,
+				    sizeof(mreqn));
 	}
 
-	ret = connect(ctx->socket.fd,
-		      (struct sockaddr *)ctx->socket.addr,
-		      ctx->socket.addrlen);
-	if (ret < 0) {
-		LOG_ERRNO("Failed to connect node to server");
+	if (ret) {
+		LOG_ERRNO("Failed to setsockopt multicast options");
 		return errno;
 	}
+	return 0;
+}
 
-	struct neutron_conn *conn = neutron_conn_new(512);
-	conn->fd = ctx->socket.fd;
-	conn->remove = 0;
-	conn->ctx = ctx;
-	neutron_ctx_add_conn(ctx, conn);
+int neutron_ctx_set_multicast(struct neutron_ctx *ctx,
+			      int ttl,
+			      int loop,
+			      const char *ifname)
+{
+	unsigned int ifindex = 0;
+	int ret;
 
-	ret = neutron_loop_add(ctx->loop,
-			       ctx->socket.fd,
-			       conn_cb,
-			       NEUTRON_FD_EVENT_IN,
-			       (void *)ctx);
-	if (ret) {
-		LOG_ERRNO("Failed to add client socket fd to loop");
-		return errno;
+	if (!ctx || ttl < 0 || ttl > 255)
+		return EINVAL;
+
+	if (ifname) {
+		ifindex = if_nametoindex(ifname);
+		if (!ifindex) {
+			LOG_ERRNO("Failed to find multicast interface");
+			return errno;
+		}
 	}
 
-	ret = neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECTED, conn);
-	if (ret) {
-		LOG_ERRNO("Failed to notify connection event");
-		return ret;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ret = neutron_ctx_set_multicast(
+			ctx->shards[i], ttl, loop, ifname);
+		if (ret)
+			return ret;
 	}
 
-	return ret;
-}
+	ctx->mcast.set = 1;
+	ctx->mcast.ttl = ttl;
+	ctx->mcast.loop = !!loop;
+	ctx->mcast.ifindex = ifindex;
 
-int neutron_ctx_send(struct neutron_ctx *ctx, uint8_t *buf, uint32_t buflen)
-{
-	int ret = 0;
-	int len;
-	if (ctx->type == NEUTRON_CLIENT) {
-		len = send(ctx->socket.fd, buf, buflen, 0);
-		ret = len == buflen ? 0 : errno;
-	} else if (ctx->type == NEUTRON_SERVER) {
-		struct neutron_conn *aux = ctx->head;
-		while (aux) {
-			len = send(aux->fd, buf, buflen, 0);
-			ret = len == buflen ? 0 : errno;
-			if (ret != 0) {
-				LOGE("Failed to send the entire buffer to connection fd: %d",
-				     aux->fd);
-				return ret;
-			}
-			aux = aux->next;
-		}
-	}
-	return ret;
+	if (ctx->type == NEUTRON_DGRAM && ctx->socket.fd > 0)
+		return ctx_apply_multicast(ctx);
+	return 0;
 }
 
-int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr)
+static int ctx_membership(struct neutron_ctx *ctx,
+			  struct neutron_addr *group,
+			  struct neutron_addr *source,
+			  const char *ifname,
+			  int join)
 {
-	int ret = 0;
-	int opt = 1;
+	unsigned int ifindex = 0;
+	int ret;
 
-	if (!ctx) {
-		LOGE("Failure: ctx is null");
+	if (!ctx || !group)
 		return EINVAL;
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ret = ctx_membership(
+			ctx->shards[i], group, source, ifname, join);
+		if (ret)
+			return ret;
 	}
+	if (ctx->nshards)
+		return 0;
 
-	ctx->type = NEUTRON_DGRAM;
+	if (ctx->type != NEUTRON_DGRAM || ctx->socket.fd <= 0) {
+		LOGE("Failure: multicast membership needs a bound ctx");
+		return ENOTCONN;
+	}
+
+	if (ifname) {
+		ifindex = if_nametoindex(ifname);
+		if (!ifindex) {
+			LOG_ERRNO("Failed to find multicast interface");
+			return errno;
+		}
+	}
+
+	/* the protocol independent requests cover IPv4 and IPv6 */
+	int level = group->ss->ss_family == AF_INET6 ? IPPROTO_IPV6
+						     : IPPROTO_IP;
+	if (source) {
+		struct group_source_req req = {.gsr_interface = ifindex};
+		memcpy(&req.gsr_group, group->ss, group->sslen);
+		memcpy(&req.gsr_source, source->ss, source->sslen);
+		ret = setsockopt(ctx->socket.fd,
+				 level,
+				 join ? MCAST_JOIN_SOURCE_GROUP
+				      : MCAST_LEAVE_SOURCE_GROUP,
+				 &req,
+				 sizeof(req));
+	} else {
+		struct group_req req = {.gr_interface = ifindex};
+		memcpy(&req.gr_group, group->ss, group->sslen);
+		ret = setsockopt(ctx->socket.fd,
+				 level,
+				 join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP,
+				 &req,
+				 sizeof(req));
+	}
+
+	if (ret) {
+		LOG_ERRNO(join ? "Failed to join multicast group"
+			       : "Failed to leave multicast group");
+		return errno;
+	}
+	return 0;
+}
+
+int neutron_ctx_join_group(struct neutron_ctx *ctx,
+			   struct neutron_addr *group,
+			   struct neutron_addr *source,
+			   const char *ifname)
+{
+	return ctx_membership(ctx, group, source, ifname, 1);
+}
+
+int neutron_ctx_leave_group(struct neutron_ctx *ctx,
+			    struct neutron_addr *group,
+			    struct neutron_addr *source,
+			    const char *ifname)
+{
+	return ctx_membership(ctx, group, source, ifname, 0);
+}
+
+int neutron_ctx_set_udp_offload(struct neutron_ctx *ctx,
+				uint16_t gso_size,
+				int gro)
+{
+	if (!ctx || gso_size > CTX_GSO_MAX_BYTES)
+		return EINVAL;
+
+	ctx->udp.gso_size = gso_size;
+	ctx->udp.gso_failed = 0;
+	ctx->udp.gro = !!gro;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		neutron_ctx_set_udp_offload(ctx->shards[i], gso_size, gro);
+
+	if (ctx->type == NEUTRON_DGRAM && ctx->socket.fd > 0)
+		return ctx_apply_udp_gro(ctx);
+	return 0;
+}
+
+int neutron_ctx_set_framing(struct neutron_ctx *ctx,
+			    enum neutron_frame_prefix prefix,
+			    uint32_t size,
+			    uint32_t max_len)
+{
+	if (!ctx)
+		return EINVAL;
+
+	if (prefix == NEUTRON_FRAME_FIXED && size != 1 && size != 2
+	    && size != 4 && size != 8)
+		return EINVAL;
+
+	if (prefix != NEUTRON_FRAME_NONE && max_len == 0)
+		return EINVAL;
+
+	ctx->frame.prefix = prefix;
+	ctx->frame.size = size;
+	ctx->frame.max_len = max_len;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->frame = ctx->frame;
+	return 0;
+}
+
+int neutron_ctx_set_conn_pool(struct neutron_ctx *ctx,
+			      uint32_t prewarm,
+			      uint32_t max)
+{
+	if (!ctx || prewarm > max)
+		return EINVAL;
+
+	if (ctx_shards_running(ctx))
+		return EBUSY;
+
+	ctx->pool.max = max;
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		int ret = neutron_ctx_set_conn_pool(ctx->shards[i], prewarm, max);
+		if (ret)
+			return ret;
+	}
+
+	/* shrink to the new cap */
+	while (ctx->pool.head && ctx->pool.stats.available > max) {
+		struct neutron_conn *conn = ctx->pool.head;
+		ctx->pool.head = conn->next;
+		ctx->pool.stats.available--;
+		neutron_conn_destroy(conn);
+	}
+
+	/* a loop group ctx only accepts on its shards */
+	if (ctx->nshards)
+		return 0;
+	return conn_pool_prewarm(ctx, prewarm);
+}
+
+int neutron_ctx_get_pool_stats(struct neutron_ctx *ctx,
+			       struct neutron_ctx_pool_stats *stats)
+{
+	if (!ctx || !stats)
+		return EINVAL;
+
+	stats->hits =
+		__atomic_load_n(&ctx->pool.stats.hits, __ATOMIC_RELAXED);
+	stats->misses =
+		__atomic_load_n(&ctx->pool.stats.misses, __ATOMIC_RELAXED);
+	stats->dropped =
+		__atomic_load_n(&ctx->pool.stats.dropped, __ATOMIC_RELAXED);
+	stats->available =
+		__atomic_load_n(&ctx->pool.stats.available, __ATOMIC_RELAXED);
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		struct neutron_ctx_pool_stats shard;
+		neutron_ctx_get_pool_stats(ctx->shards[i], &shard);
+		stats->hits += shard.hits;
+		stats->misses += shard.misses;
+		stats->dropped += shard.dropped;
+		stats->available += shard.available;
+	}
+	return 0;
+}
+
+size_t neutron_conn_get_write_pending(struct neutron_conn *conn)
+{
+	return conn ? conn->writeq.pending : 0;
+}
+
+void neutron_conn_set_userdata(struct neutron_conn *conn, void *userdata)
+{
+	if (conn)
+		conn->userdata = userdata;
+}
+
+void *neutron_conn_get_userdata(struct neutron_conn *conn)
+{
+	return conn ? conn->userdata : NULL;
+}
+
+int neutron_ctx_set_accept_batch(struct neutron_ctx *ctx, uint32_t max)
+{
+	if (!ctx || max == 0)
+		return EINVAL;
+
+	ctx->accept_batch = max;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		ctx->shards[i]->accept_batch = max;
+	return 0;
+}
+
+int neutron_ctx_get_accept_stats(struct neutron_ctx *ctx,
+				 struct neutron_ctx_accept_stats *stats)
+{
+	if (!ctx || !stats)
+		return EINVAL;
+
+	stats->accepted = __atomic_load_n(
+		&ctx->accept_stats.accepted, __ATOMIC_RELAXED);
+	stats->failed =
+		__atomic_load_n(&ctx->accept_stats.failed, __ATOMIC_RELAXED);
+	stats->wakeups =
+		__atomic_load_n(&ctx->accept_stats.wakeups, __ATOMIC_RELAXED);
+	stats->capped =
+		__atomic_load_n(&ctx->accept_stats.capped, __ATOMIC_RELAXED);
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		struct neutron_ctx_accept_stats shard;
+		neutron_ctx_get_accept_stats(ctx->shards[i], &shard);
+		stats->accepted += shard.accepted;
+		stats->failed += shard.failed;
+		stats->wakeups += shard.wakeups;
+		stats->capped += shard.capped;
+	}
+	return 0;
+}
+
+int neutron_ctx_set_zerocopy(struct neutron_ctx *ctx,
+			     neutron_ctx_zc_release_cb cb)
+{
+	if (!ctx || !cb)
+		return EINVAL;
+
+	ctx->zc_release_cb = cb;
+	for (uint32_t i = 0; i < ctx->nshards; i++)
+		neutron_ctx_set_zerocopy(ctx->shards[i], cb);
+
+	for (struct neutron_conn *aux = ctx->head; aux; aux = aux->next) {
+		if (!aux->zc.enabled && ctx->type != NEUTRON_DGRAM)
+			conn_enable_zerocopy(aux);
+	}
+	return 0;
+}
+
+int neutron_ctx_get_zerocopy_stats(struct neutron_ctx *ctx,
+				   struct neutron_ctx_zerocopy_stats *stats)
+{
+	if (!ctx || !stats)
+		return EINVAL;
+
+	stats->sends =
+		__atomic_load_n(&ctx->zc_stats.sends, __ATOMIC_RELAXED);
+	stats->completions =
+		__atomic_load_n(&ctx->zc_stats.completions, __ATOMIC_RELAXED);
+	stats->copied =
+		__atomic_load_n(&ctx->zc_stats.copied, __ATOMIC_RELAXED);
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		struct neutron_ctx_zerocopy_stats shard;
+		neutron_ctx_get_zerocopy_stats(ctx->shards[i], &shard);
+		stats->sends += shard.sends;
+		stats->completions += shard.completions;
+		stats->copied += shard.copied;
+	}
+	return 0;
+}
+
+int neutron_ctx_listen(struct neutron_ctx *ctx, struct neutron_addr *addr)
+{
+	int ret, opt = 1;
+
+	if (!ctx || !addr || !addr->ss)
+		return EINVAL;
+
+	if (ctx_shards_running(ctx))
+		return EBUSY;
+
+	ctx->type = NEUTRON_SERVER;
+
+	if (ctx->nshards) {
+		if (addr->ss->ss_family == AF_UNIX) {
+			LOGE("Failure: unix sockets cannot be sharded");
+			return EAFNOSUPPORT;
+		}
+
+		ctx->socket.addr = addr->ss;
+		ctx->socket.addrlen = addr->sslen;
+		ctx->socket.type = addr->ss->ss_family;
+		ctx->socket.fd = -1;
+		for (uint32_t i = 0; i < ctx->nshards; i++) {
+			ret = neutron_ctx_listen(ctx->shards[i], addr);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	ctx->socket.addr = addr->ss;
+	ctx->socket.addrlen = addr->sslen;
+	ctx->socket.type = addr->ss->ss_family;
+	ctx->socket.fd = socket(ctx->socket.type,
+				SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				0);
+
+	if (ctx->socket.fd < 0) {
+		LOG_ERRNO("Failed to create socket fd");
+		return errno;
+	}
+
+	if (ctx->fd_cb)
+		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
+
+	ret = setsockopt(
+		ctx->socket.fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (ret) {
+		LOG_ERRNO("Failed to setsockopt");
+		return ret;
+	}
+
+	if (ctx->reuseport) {
+		ret = setsockopt(ctx->socket.fd,
+				 SOL_SOCKET,
+				 SO_REUSEPORT,
+				 &opt,
+				 sizeof(opt));
+		if (ret) {
+			LOG_ERRNO("Failed to set SO_REUSEPORT");
+			return ret;
+		}
+	}
+
+	ret = bind(ctx->socket.fd,
+		   (struct sockaddr *)ctx->socket.addr,
+		   ctx->socket.addrlen);
+	if (ret) {
+		LOG_ERRNO("Failed to bind socket");
+		return ret;
+	}
+
+	ret = listen(ctx->socket.fd, ctx->backlog);
+	if (ret) {
+		LOG_ERRNO("Failed to start listening");
+		return ret;
+	}
+
+	ret = ctx_accept_start(ctx);
+	if (ret != ENOTSUP)
+		return ret;
+
+	ret = neutron_loop_add(ctx->loop,
+			       ctx->socket.fd,
+			       listen_cb,
+			       NEUTRON_FD_EVENT_IN,
+			       (void *)ctx);
+
+	if (ret) {
+		LOG_ERRNO("Failed to register socket fd in event loop");
+		return ret;
+	}
+
+	return 0;
+}
+
+/* errors of accept(2) that are about the pending connection only, the
+ * next one in the queue may succeed */
+static int ctx_accept_error_transient(int err)
+{
+	switch (err) {
+	case EPERM:
+	case EPROTO:
+	case ENOPROTOOPT:
+	case EOPNOTSUPP:
+	case ENETDOWN:
+	case ENETUNREACH:
+	case ENONET:
+	case EHOSTDOWN:
+	case EHOSTUNREACH:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+void listen_cb(int server_fd, uint32_t revents, void *userdata)
+{
+	struct neutron_ctx *ctx = (struct neutron_ctx *)userdata;
+	uint64_t accepted = 0, failed = 0;
+	int ret = 0;
+
+	/* the listener is non-blocking: drain the accept queue, but yield to
+	 * the other fds after accept_batch attempts. Errors that take nothing
+	 * off the queue (out of fds or memory, a shut down or broken listener)
+	 * would fail again right away. */
+	while (accepted + failed < ctx->accept_batch) {
+		ret = server_accept_conn(server_fd, ctx);
+		if (ret == EAGAIN || ret == EWOULDBLOCK)
+			break;
+		if (ret) {
+			failed++;
+			if (!ctx_accept_error_transient(ret))
+				break;
+			continue;
+		}
+		accepted++;
+	}
+
+	/* relaxed atomics: stats of a sharded ctx are read from other threads */
+	__atomic_add_fetch(&ctx->accept_stats.wakeups, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(
+		&ctx->accept_stats.accepted, accepted, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctx->accept_stats.failed, failed, __ATOMIC_RELAXED);
+	if (accepted + failed == ctx->accept_batch)
+		__atomic_add_fetch(
+			&ctx->accept_stats.capped, 1, __ATOMIC_RELAXED);
+}
+
+static int client_attach_conn(struct neutron_ctx *ctx)
+{
+	int ret;
+
+	struct neutron_conn *conn = conn_pool_get(ctx);
+	if (!conn)
+		return ENOMEM;
+
+	conn->fd = ctx->socket.fd;
+	conn->remove = 0;
+	conn->ctx = ctx;
+	neutron_ctx_add_conn(ctx, conn);
+
+	if (ctx->zc_release_cb)
+		conn_enable_zerocopy(conn);
+
+	ret = ctx_watch_conn(ctx, conn);
+	if (ret) {
+		LOG_ERRNO("Failed to add client socket fd to loop");
+		/* the socket stays owned by the ctx */
+		neutron_ctx_unlink_conn(ctx, conn);
+		conn->fd = -1;
+		conn_pool_put(ctx, conn);
+		return ret;
+	}
+
+	ret = neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECTED, conn);
+	if (ret) {
+		LOG_ERRNO("Failed to notify connection event");
+		return ret;
+	}
+
+	return ret;
+}
+
+/* ends a pending asynchronous connect, err is 0 on success */
+static void client_connect_done(struct neutron_ctx *ctx, int err)
+{
+	int fd = ctx->socket.fd;
+
+	ctx->connecting = 0;
+	if (ctx->connect_timer)
+		neutron_timer_clear(ctx->connect_timer);
+
+	/* swap the connect watch for the connection callback */
+	neutron_loop_remove(ctx->loop, fd);
+
+	if (!err) {
+		err = client_attach_conn(ctx);
+		if (!err)
+			return;
+	}
+
+	ctx->connect_error = err;
+	errno = err;
+	LOG_ERRNO("Failed to connect node to server");
+
+	/* the failure is reported on a conn that never joins the ctx, it
+	 * stays out of the pool and its stats, and refuses sends */
+	struct neutron_conn failed;
+	memset(&failed, 0, sizeof(failed));
+	failed.fd = fd;
+	failed.ctx = ctx;
+	failed.remove = 1;
+	failed.local = &failed.local_ss;
+	failed.peer = &failed.peer_ss;
+	memcpy(failed.peer, ctx->socket.addr, ctx->socket.addrlen);
+	failed.peer_addrlen = ctx->socket.addrlen;
+	neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECT_FAILED, &failed);
+	close(fd);
+
+	if (ctx->socket.fd == fd)
+		ctx->socket.fd = -1;
+}
+
+int neutron_ctx_connect(struct neutron_ctx *ctx, struct neutron_addr *addr)
+{
+	int ret = 0;
+
+	if (!ctx) {
+		LOGE("Failure: ctx is null");
+		return EINVAL;
+	}
+	ctx->type = NEUTRON_CLIENT;
+
+	if (!addr || !addr->ss) {
+		LOGE("Failure: cannot connect to null address");
+		return EINVAL;
+	}
+	ctx->socket.addr = addr->ss;
+	ctx->socket.addrlen = addr->sslen;
+	ctx->socket.type = addr->ss->ss_family;
+
+	/* connects blocking, the fd is made non-blocking afterwards */
+	ctx->socket.fd =
+		socket(ctx->socket.type, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (ctx->socket.fd < 0) {
+		LOG_ERRNO("Failed to create client socket");
+		return errno;
+	}
+
+	if (ctx->fd_cb) {
+		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
+	}
+
+	ret = connect(ctx->socket.fd,
+		      (struct sockaddr *)ctx->socket.addr,
+		      ctx->socket.addrlen);
+	if (ret < 0) {
+		LOG_ERRNO("Failed to connect node to server");
+		return errno;
+	}
+
+	ret = neutron_ctx_prepare_conn_fd(ctx, ctx->socket.fd);
+	if (ret)
+		return ret;
+
+	return client_attach_conn(ctx);
+}
+
+static void connect_timeout_cb(struct neutron_timer *timer, void *userdata)
+{
+	struct neutron_ctx *ctx = (struct neutron_ctx *)userdata;
+
+	if (ctx->connecting)
+		client_connect_done(ctx, ETIMEDOUT);
+}
+
+void connect_cb(int conn_fd, uint32_t revents, void *userdata)
+{
+	struct neutron_ctx *ctx = (struct neutron_ctx *)userdata;
+	int err = 0;
+	socklen_t errlen = sizeof(err);
+
+	if (!ctx->connecting)
+		return;
+
+	if (getsockopt(conn_fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0)
+		err = errno;
+	else if (!err && (revents & (NEUTRON_FD_EVENT_ERROR
+				     | NEUTRON_FD_EVENT_HUP)))
+		err = ECONNREFUSED;
+
+	client_connect_done(ctx, err);
+}
+
+int neutron_ctx_connect_async(struct neutron_ctx *ctx,
+			      struct neutron_addr *addr,
+			      uint32_t timeout_ms)
+{
+	int ret = 0;
+
+	if (!ctx) {
+		LOGE("Failure: ctx is null");
+		return EINVAL;
+	}
+
+	if (!addr || !addr->ss) {
+		LOGE("Failure: cannot connect to null address");
+		return EINVAL;
+	}
+
+	if (ctx->connecting) {
+		LOGE("Failure: a connection is already in progress");
+		return EALREADY;
+	}
+
+	ctx->type = NEUTRON_CLIENT;
+	ctx->socket.addr = addr->ss;
+	ctx->socket.addrlen = addr->sslen;
+	ctx->socket.type = addr->ss->ss_family;
+	ctx->connect_error = 0;
+
+	if (timeout_ms && !ctx->connect_timer) {
+		ctx->connect_timer =
+			neutron_timer_create_with_flags(ctx->loop,
+							NEUTRON_TIMER_WHEEL,
+							&connect_timeout_cb,
+							ctx);
+		if (!ctx->connect_timer)
+			return ENOMEM;
+	}
+
+	ctx->socket.fd = socket(ctx->socket.type,
+				SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				0);
+	if (ctx->socket.fd < 0) {
+		LOG_ERRNO("Failed to create client socket");
+		return errno;
+	}
+
+	if (ctx->fd_cb) {
+		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
+	}
+
+	do {
+		ret = connect(ctx->socket.fd,
+			      (struct sockaddr *)ctx->socket.addr,
+			      ctx->socket.addrlen);
+	} while (ret < 0 && errno == EINTR);
+
+	/* local peers may accept right away */
+	if (ret == 0)
+		return client_attach_conn(ctx);
+
+	if (errno != EINPROGRESS) {
+		ret = errno;
+		LOG_ERRNO("Failed to connect node to server");
+		close(ctx->socket.fd);
+		ctx->socket.fd = -1;
+		return ret;
+	}
+
+	/* the socket turns writable once the handshake is over, whatever
+	 * its outcome */
+	ret = neutron_loop_add(ctx->loop,
+			       ctx->socket.fd,
+			       connect_cb,
+			       NEUTRON_FD_EVENT_OUT,
+			       (void *)ctx);
+	if (ret) {
+		LOG_ERRNO("Failed to add client socket fd to loop");
+		close(ctx->socket.fd);
+		ctx->socket.fd = -1;
+		return ret;
+	}
+	ctx->connecting = 1;
+
+	if (timeout_ms) {
+		ret = neutron_timer_set(ctx->connect_timer, timeout_ms);
+		if (ret) {
+			LOGE("Failed to arm the connect timeout");
+			ctx->connecting = 0;
+			neutron_loop_remove(ctx->loop, ctx->socket.fd);
+			close(ctx->socket.fd);
+			ctx->socket.fd = -1;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+int neutron_ctx_get_connect_error(struct neutron_ctx *ctx)
+{
+	if (!ctx)
+		return EINVAL;
+
+	return ctx->connect_error;
+}
+
+int neutron_ctx_send(struct neutron_ctx *ctx, uint8_t *buf, uint32_t buflen)
+{
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = buflen,
+	};
+
+	return neutron_ctx_sendv(ctx, &iov, 1);
+}
+
+int neutron_ctx_sendv(struct neutron_ctx *ctx,
+		      const struct iovec *iov,
+		      int iovcnt)
+{
+	int ret = 0, err;
+
+	if (!ctx)
+		return EINVAL;
+
+	if (ctx_shards_running(ctx))
+		return EBUSY;
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		ret = neutron_ctx_sendv(ctx->shards[i], iov, iovcnt);
+		if (ret)
+			return ret;
+	}
+
+	if (ctx->type == NEUTRON_CLIENT) {
+		if (!ctx->head)
+			return ENOTCONN;
+		ret = conn_sendv(ctx->head, iov, iovcnt);
+	} else if (ctx->type == NEUTRON_SERVER) {
+		/* a failing connection does not hold back the others */
+		struct neutron_conn *aux = ctx->head;
+		while (aux) {
+			err = conn_sendv(aux, iov, iovcnt);
+			if (err) {
+				LOGE("Failed to send the buffer to connection fd: %d",
+				     aux->fd);
+				if (!ret)
+					ret = err;
+			}
+			aux = aux->next;
+		}
+	}
+	return ret;
+}
+
+/* a failing connection does not hold back the others, the first error is
+ * returned */
+static int ctx_send_buf(struct neutron_ctx *ctx,
+			struct neutron_buf *buf,
+			neutron_ctx_send_error_cb cb)
+{
+	int ret = 0, err;
+
+	if (ctx_shards_running(ctx))
+		return EBUSY;
+
+	for (uint32_t i = 0; i < ctx->nshards; i++) {
+		err = ctx_send_buf(ctx->shards[i], buf, cb);
+		if (err && !ret)
+			ret = err;
+	}
+
+	if (ctx->type == NEUTRON_CLIENT && !ctx->head)
+		return ret ? ret : ENOTCONN;
+
+	if (ctx->type != NEUTRON_CLIENT && ctx->type != NEUTRON_SERVER)
+		return ret;
+
+	struct neutron_conn *aux = ctx->head;
+	while (aux) {
+		err = conn_send_buf(aux, buf);
+		if (err) {
+			if (cb)
+				(*cb)(ctx, aux, err, ctx->userdata);
+			else
+				LOGE("Failed to send the buffer to connection fd: %d",
+				     aux->fd);
+			if (!ret)
+				ret = err;
+		}
+		aux = aux->next;
+	}
+	return ret;
+}
+
+int neutron_ctx_send_buf(struct neutron_ctx *ctx,
+			 struct neutron_buf *buf,
+			 neutron_ctx_send_error_cb cb)
+{
+	if (!ctx || !buf)
+		return EINVAL;
+
+	return ctx_send_buf(ctx, buf, cb);
+}
+
+int neutron_ctx_send_zerocopy(struct neutron_ctx *ctx,
+			      const uint8_t *buf,
+			      size_t buflen,
+			      void *cookie)
+{
+	if (!ctx || !buf || !ctx->zc_release_cb)
+		return EINVAL;
+
+	struct neutron_buf *zc = buf_new_zerocopy(ctx, buf, buflen, cookie);
+	if (!zc)
+		return ENOMEM;
+
+	int ret = ctx_send_buf(ctx, zc, NULL);
+
+	/* released right away if no connection kept a reference */
+	neutron_buf_unref(zc);
+	return ret;
+}
+
+int neutron_conn_send(struct neutron_conn *conn,
+		      const uint8_t *buf,
+		      uint32_t buflen)
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = buflen,
+	};
+
+	return neutron_conn_sendv(conn, &iov, 1);
+}
+
+int neutron_conn_sendv(struct neutron_conn *conn,
+		       const struct iovec *iov,
+		       int iovcnt)
+{
+	if (!conn || !conn->ctx)
+		return EINVAL;
+
+	if (conn->ctx->type == NEUTRON_DGRAM)
+		return conn_sendv_dgram(conn, iov, iovcnt);
+
+	return conn_sendv(conn, iov, iovcnt);
+}
+
+int neutron_conn_send_buf(struct neutron_conn *conn, struct neutron_buf *buf)
+{
+	if (!conn || !conn->ctx || !buf)
+		return EINVAL;
+
+	if (conn->ctx->type == NEUTRON_DGRAM) {
+		struct iovec iov = {
+			.iov_base = (void *)buf->data,
+			.iov_len = buf->len,
+		};
+		return conn_sendv_dgram(conn, &iov, 1);
+	}
+
+	return conn_send_buf(conn, buf);
+}
+
+int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr)
+{
+	int ret = 0;
+	int opt = 1;
+
+	if (!ctx) {
+		LOGE("Failure: ctx is null");
+		return EINVAL;
+	}
+
+	ctx->type = NEUTRON_DGRAM;
 
 	if (!addr) {
 		LOGE("Failure: addr is null");
@@ -497,6 +1634,18 @@ int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr)
 		return ret;
 	}
 
+	if (ctx->udp.gro) {
+		ret = ctx_apply_udp_gro(ctx);
+		if (ret)
+			return ret;
+	}
+
+	if (ctx->mcast.set) {
+		ret = ctx_apply_multicast(ctx);
+		if (ret)
+			return ret;
+	}
+
 	if (ctx->fd_cb)
 		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
 
@@ -509,7 +1658,17 @@ int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr)
 	ctx->socket.addr = addr->ss;
 	ctx->socket.addrlen = addr->sslen;
 
-	struct neutron_conn *conn = neutron_conn_new(512);
+	ret = neutron_ctx_prepare_conn_fd(ctx, ctx->socket.fd);
+	if (ret)
+		return ret;
+
+	struct neutron_conn *conn = conn_pool_get(ctx);
+	if (!conn) {
+		close(ctx->socket.fd);
+		ctx->socket.fd = -1;
+		return ENOMEM;
+	}
+
 	conn->fd = ctx->socket.fd;
 	conn->remove = 0;
 	conn->ctx = ctx;
@@ -521,11 +1680,15 @@ int neutron_ctx_bind(struct neutron_ctx *ctx, struct neutron_addr *addr)
 	ret = neutron_loop_add(ctx->loop,
 			       ctx->socket.fd,
 			       conn_cb,
-			       NEUTRON_FD_EVENT_IN,
-			       (void *)ctx);
+			       neutron_ctx_conn_events(ctx),
+			       (void *)conn);
 	if (ret) {
 		LOG_ERRNO("Failed to add client socket fd to loop");
-		return errno;
+		neutron_ctx_unlink_conn(ctx, conn);
+		/* closes the socket */
+		conn_pool_put(ctx, conn);
+		ctx->socket.fd = -1;
+		return ret;
 	}
 
 	ret = neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECTED, conn);
@@ -561,12 +1724,35 @@ int neutron_ctx_broadcast(struct neutron_ctx *ctx)
 		return ret;
 	}
 
+	if (ctx->udp.gro) {
+		ret = ctx_apply_udp_gro(ctx);
+		if (ret)
+			return ret;
+	}
+
+	if (ctx->mcast.set) {
+		ret = ctx_apply_multicast(ctx);
+		if (ret)
+			return ret;
+	}
+
 	if (ctx->fd_cb)
 		(*ctx->fd_cb)(ctx, ctx->socket.fd, ctx->userdata);
 
-	struct neutron_conn *conn = neutron_conn_new(512);
+	ret = neutron_ctx_prepare_conn_fd(ctx, ctx->socket.fd);
+	if (ret)
+		return ret;
+
+	struct neutron_conn *conn = conn_pool_get(ctx);
+	if (!conn) {
+		close(ctx->socket.fd);
+		ctx->socket.fd = -1;
+		return ENOMEM;
+	}
+
 	conn->fd = ctx->socket.fd;
 	conn->remove = 0;
+	conn->ctx = ctx;
 
 	conn->local = ctx->socket.addr;
 	conn->local_addlren = ctx->socket.addrlen;
@@ -575,21 +1761,120 @@ int neutron_ctx_broadcast(struct neutron_ctx *ctx)
 	ret = neutron_loop_add(ctx->loop,
 			       ctx->socket.fd,
 			       conn_cb,
-			       NEUTRON_FD_EVENT_IN,
-			       (void *)ctx);
+			       neutron_ctx_conn_events(ctx),
+			       (void *)conn);
 	if (ret) {
 		LOG_ERRNO("Failed to add client socket fd to loop");
+		neutron_ctx_unlink_conn(ctx, conn);
+		/* closes the socket */
+		conn_pool_put(ctx, conn);
+		ctx->socket.fd = -1;
 		return ret;
 	}
 
 	return 0;
 }
 
+/* splits buf into datagrams of seg bytes in userspace */
+static int ctx_send_to_segments(struct neutron_ctx *ctx,
+				struct neutron_addr *addr,
+				uint8_t *buf,
+				uint32_t buflen,
+				uint16_t seg)
+{
+	struct neutron_dgram dgrams[CTX_SENDMMSG_BATCH];
+	uint32_t off = 0;
+
+	while (off < buflen) {
+		uint32_t count = 0;
+		while (count < CTX_SENDMMSG_BATCH && off < buflen) {
+			uint32_t len = buflen - off < seg ? buflen - off : seg;
+			dgrams[count].buf = buf + off;
+			dgrams[count].len = len;
+			dgrams[count].addr = addr;
+			count++;
+			off += len;
+		}
+
+		int ret = neutron_ctx_send_to_batch(ctx, dgrams, count, NULL);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* one sendmsg carries up to 64 datagrams of gso size, the kernel or the
+ * device segments them */
+static int ctx_send_to_gso(struct neutron_ctx *ctx,
+			   struct neutron_addr *addr,
+			   uint8_t *buf,
+			   uint32_t buflen)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} control;
+	uint16_t seg = ctx->udp.gso_size;
+	uint32_t max = CTX_GSO_MAX_BYTES / seg;
+	uint32_t off = 0;
+
+	if (ctx->udp.gso_failed)
+		return ctx_send_to_segments(ctx, addr, buf, buflen, seg);
+
+	if (max > CTX_GSO_MAX_SEGMENTS)
+		max = CTX_GSO_MAX_SEGMENTS;
+	max *= seg;
+
+	while (off < buflen) {
+		uint32_t len = buflen - off < max ? buflen - off : max;
+		struct iovec iov = {.iov_base = buf + off, .iov_len = len};
+		struct msghdr msg = {
+			.msg_name = addr->ss,
+			.msg_namelen = addr->sslen,
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+
+		if (len > seg) {
+			msg.msg_control = control.buf;
+			msg.msg_controllen = sizeof(control.buf);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			memcpy(CMSG_DATA(cmsg), &seg, sizeof(seg));
+		}
+
+		ssize_t ret;
+		do {
+			ret = sendmsg(ctx->socket.fd, &msg, 0);
+		} while (ret < 0 && errno == EINTR);
+
+		/* no checksum offload on the route or a gso size above the
+		 * mtu, segment in userspace from now on */
+		if (ret < 0 && len > seg && (errno == EIO || errno == EINVAL)) {
+			LOG_ERRNO("UDP_SEGMENT send failed, segmenting in "
+				  "userspace");
+			ctx->udp.gso_failed = 1;
+			return ctx_send_to_segments(
+				ctx, addr, buf + off, buflen - off, seg);
+		}
+		if (ret < 0)
+			return errno;
+
+		off += len;
+	}
+	return 0;
+}
+
 int neutron_ctx_send_to(struct neutron_ctx *ctx,
 			struct neutron_addr *addr,
 			uint8_t *buf,
 			uint32_t buflen)
 {
+	if (ctx->udp.gso_size && buflen > ctx->udp.gso_size)
+		return ctx_send_to_gso(ctx, addr, buf, buflen);
+
 	int datalen = sendto(ctx->socket.fd,
 			     buf,
 			     buflen,
@@ -599,9 +1884,78 @@ int neutron_ctx_send_to(struct neutron_ctx *ctx,
 	return datalen > 0 ? 0 : errno;
 }
 
+int neutron_ctx_send_to_batch(struct neutron_ctx *ctx,
+			      const struct neutron_dgram *dgrams,
+			      uint32_t count,
+			      uint32_t *sent)
+{
+	struct mmsghdr msgs[CTX_SENDMMSG_BATCH];
+	struct iovec iovs[CTX_SENDMMSG_BATCH];
+	uint32_t done = 0;
+	int ret = 0;
+
+	if (!ctx || (count && !dgrams))
+		return EINVAL;
+
+	while (done < count) {
+		uint32_t n = count - done;
+		if (n > CTX_SENDMMSG_BATCH)
+			n = CTX_SENDMMSG_BATCH;
+
+		memset(msgs, 0, n * sizeof(struct mmsghdr));
+		for (uint32_t i = 0; i < n; i++) {
+			const struct neutron_dgram *dgram = &dgrams[done + i];
+			iovs[i].iov_base = dgram->buf;
+			iovs[i].iov_len = dgram->len;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = dgram->addr->ss;
+			msgs[i].msg_hdr.msg_namelen = dgram->addr->sslen;
+		}
+
+		int len;
+		do {
+			len = sendmmsg(ctx->socket.fd, msgs, n, 0);
+		} while (len < 0 && errno == EINTR);
+
+		/* the datagram after a partial batch reports its error on the
+		 * next call */
+		if (len < 0) {
+			ret = errno;
+			break;
+		}
+		done += len;
+	}
+
+	if (sent)
+		*sent = done;
+	return ret;
+}
+
 int neutron_ctx_disconnect(struct neutron_ctx *ctx)
 {
 	int ret = 0;
+
+	if (ctx_shards_running(ctx))
+		return EBUSY;
+
+	if (ctx->nshards) {
+		for (uint32_t i = 0; i < ctx->nshards; i++) {
+			ret = neutron_ctx_disconnect(ctx->shards[i]);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	if (ctx->connecting) {
+		ctx->connecting = 0;
+		if (ctx->connect_timer)
+			neutron_timer_clear(ctx->connect_timer);
+	}
+
+	session_clear(ctx, 1);
+
 	VLOGE("neutron_ctx_notify_event");
 	ret = neutron_ctx_notify_event(
 		ctx, NEUTRON_EVENT_DISCONNECTED, ctx->head);
@@ -614,19 +1968,26 @@ int neutron_ctx_disconnect(struct neutron_ctx *ctx)
 	aux = ctx->head;
 	while (aux) {
 		next = aux->next;
+		/* a client or datagram conn closes the ctx socket itself */
+		if (aux->fd == ctx->socket.fd)
+			ctx->socket.fd = -1;
 		neutron_ctx_remove_conn(ctx, aux);
 		aux = next;
 	}
 
-	if (ctx->socket.fd > 0) {
+	if (ctx->socket.fd > 0 && ctx->accept) {
+		/* the listener is not polled */
+		ctx_accept_stop(ctx);
+	} else if (ctx->socket.fd > 0) {
 		ret = neutron_loop_remove(ctx->loop, ctx->socket.fd);
 		if (ret) {
 			LOG_ERRNO("Failed to remove ctx fd from loop");
 			return ret;
 		}
+	}
 
+	if (ctx->socket.fd > 0)
 		ret = close(ctx->socket.fd);
-	}
 
 	LOGD("Socked fd(%d) already closed", ctx->socket.fd);
 	return 0;
@@ -635,50 +1996,66 @@ int neutron_ctx_disconnect(struct neutron_ctx *ctx)
 int neutron_ctx_remove_conn(struct neutron_ctx *ctx, struct neutron_conn *conn)
 {
 	int ret = 0;
-	uint8_t found = 0;
 
-	struct neutron_conn *aux = ctx->head;
-	if (aux == conn) {
-		found = 1;
-		ctx->head = ctx->head->next;
-	} else {
-		while (aux->next && aux->next != conn)
-			aux = aux->next;
-		if (aux->next == conn) {
-			found = 1;
-			aux->next = aux->next->next;
-		} else {
-			LOGE("Failed to find conn in ctx");
-			return EINVAL;
-		}
+	if (conn->ctx != ctx) {
+		LOGE("Failed to find conn in ctx");
+		return EINVAL;
 	}
 
-	if (found) {
-		ret = neutron_ctx_notify_event(
-			ctx, NEUTRON_EVENT_DISCONNECTED, conn);
-		if (ret) {
-			LOG_ERRNO("Failed to notify disconnection event");
-		}
+	neutron_ctx_unlink_conn(ctx, conn);
+
+	ret = neutron_ctx_notify_event(
+		ctx, NEUTRON_EVENT_DISCONNECTED, conn);
+	if (ret) {
+		LOG_ERRNO("Failed to notify disconnection event");
+	}
 
+	/* completion-based conns are not polled, the pool cancels their
+	 * requests */
+	if (!conn->uring) {
 		ret = neutron_loop_remove(ctx->loop, conn->fd);
-		if (ret) {
+		if (ret)
 			LOG_ERRNO("Failed to remove connection fd from loop");
-			return ret;
-		}
-		neutron_conn_destroy(conn);
 	}
-	return 0;
+
+	/* the conn is unlinked already, release it even if the loop did not
+	 * know its fd */
+	conn_pool_put(ctx, conn);
+	return ret;
 }
 
 void neutron_ctx_destroy(struct neutron_ctx *ctx)
 {
 	if (ctx) {
+		if (ctx_shards_running(ctx)) {
+			LOGE("Failure: the loop group of the ctx is running");
+			return;
+		}
+
+		if (ctx->shards) {
+			for (uint32_t i = 0; i < ctx->nshards; i++)
+				neutron_ctx_destroy(ctx->shards[i]);
+			free(ctx->shards);
+			ctx->shards = NULL;
+			ctx->nshards = 0;
+		}
+
 		if (ctx->socket.type == AF_UNIX
 		    && ctx->type == NEUTRON_SERVER) {
 			(void)remove(((struct sockaddr_un *)ctx->socket.addr)
 					     ->sun_path);
 		}
 
+		if (ctx->connect_timer) {
+			neutron_timer_destroy(ctx->connect_timer);
+			ctx->connect_timer = NULL;
+		}
+
+		ctx_accept_stop(ctx);
+
+		session_clear(ctx, 0);
+		conn_pool_clear(ctx);
+
 		struct neutron_conn *aux = ctx->head;
 		if (ctx->head) {
 			ctx->head = ctx->head->next;
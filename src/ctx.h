@@ -3,14 +3,37 @@
 
 #include <neutron_priv.h>
 #include <neutron.h>
+#include <session.h>
+#include <uring.h>
 
-#define MAX_SERVER_CONNECTIONS 16
+#define CTX_LISTEN_BACKLOG SOMAXCONN
+#define CTX_ACCEPT_BATCH 64
+#define CTX_SENDMMSG_BATCH 64
+#define CTX_GSO_MAX_BYTES 65507
+#define CTX_GSO_MAX_SEGMENTS 64
 
 struct neutron_addr {
 	struct sockaddr_storage *ss;
 	socklen_t sslen;
 };
 
+/* released conns kept with their read buffer for the next connections,
+ * only used from the loop thread of the ctx */
+struct neutron_conn_pool {
+	struct neutron_conn *head;
+	uint32_t max;
+	struct neutron_ctx_pool_stats stats;
+};
+
+/* multishot accept of a listener on an io_uring loop, freed by its last
+ * completion once the listener is closed */
+struct neutron_ctx_accept {
+	struct neutron_uring_op op;
+	struct neutron_ctx *ctx;
+	struct neutron_loop *loop;
+	int armed;
+};
+
 struct neutron_ctx {
 	struct neutron_loop *loop;
 
@@ -27,18 +50,88 @@ struct neutron_ctx {
 
 	int ext_loop;
 
+	/* connections are non-blocking, edge-triggered and drained on read */
+	int edge_triggered;
+
+	/* listener is opened with SO_REUSEPORT */
+	int reuseport;
+
+	/* listen queue length and accept attempts per wakeup */
+	int backlog;
+	uint32_t accept_batch;
+	struct neutron_ctx_accept_stats accept_stats;
+	struct neutron_ctx_accept *accept;
+
+	/* read buffer size of new conns, grown up to readbuf_max_size while
+	 * reads fill it */
+	size_t readbuf_size;
+	size_t readbuf_max_size;
+
+	struct neutron_conn_pool pool;
+
+	/* stream data is cut into length-prefixed frames before data_cb */
+	struct {
+		enum neutron_frame_prefix prefix;
+		uint32_t size;
+		uint32_t max_len;
+	} frame;
+
+	/* pending outbound bytes per conn that trigger the watermark events */
+	size_t write_high_watermark;
+	size_t write_low_watermark;
+
+	/* connections set SO_ZEROCOPY, called when a zero-copy buffer may be
+	 * reused */
+	neutron_ctx_zc_release_cb zc_release_cb;
+	struct neutron_ctx_zerocopy_stats zc_stats;
+
+	/* asynchronous connect in progress on socket.fd */
+	int connecting;
+	int connect_error;
+	struct neutron_timer *connect_timer;
+
+	/* datagrams read per recvmmsg, 1 for plain recvfrom */
+	uint32_t dgram_batch;
+	neutron_ctx_dgram_batch_cb dgram_batch_cb;
+
+	/* udp segmentation offload, gso_failed once the route refused it */
+	struct {
+		uint16_t gso_size;
+		int gso_failed;
+		int gro;
+	} udp;
+
+	struct neutron_session_table sessions;
+
+	/* outbound multicast settings, applied to the socket once bound */
+	struct {
+		uint8_t set;
+		int ttl;
+		int loop;
+		unsigned int ifindex;
+	} mcast;
+
+	/* per-loop contexts of a ctx created on a loop group */
+	struct neutron_loop_group *group;
+	struct neutron_ctx **shards;
+	uint32_t nshards;
+
 	neutron_ctx_fd_cb fd_cb;
 
 	neutron_ctx_event_cb event_cb;
 
 	neutron_ctx_data_cb data_cb;
 
-	struct neutron_conn *head;
+	struct neutron_conn *head, *tail;
 };
 
 struct neutron_conn *neutron_ctx_find_connection(struct neutron_ctx *ctx,
 						 int fd);
 
+uint32_t neutron_ctx_conn_events(struct neutron_ctx *ctx);
+
+int neutron_ctx_prepare_conn_fd(struct neutron_ctx *ctx, int fd);
+
 int neutron_ctx_notify_event(struct neutron_ctx *ctx,
 			     enum neutron_event,
 			     struct neutron_conn *conn);
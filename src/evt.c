@@ -34,6 +34,8 @@ clean:
 void neutron_evt_destroy(struct neutron_evt *evt)
 {
 	if (evt) {
+		if (evt->loop)
+			neutron_evt_detach(evt, evt->loop);
 		close(evt->fd);
 		free(evt);
 		evt = NULL;
@@ -111,6 +113,7 @@ int neutron_evt_attach(struct neutron_evt *evt, struct neutron_loop *loop)
 
 	if (ret) {
 		LOGE("Failed to attach neutron evt to loop");
+		evt->loop = NULL;
 		return ret;
 	}
 
@@ -122,6 +125,7 @@ int neutron_evt_detach(struct neutron_evt *evt, struct neutron_loop *loop)
 	int ret = 0;
 
 	ret = neutron_loop_remove(loop, evt->fd);
+	evt->loop = NULL;
 	if (ret) {
 		LOGE("Failure: cannot detach eventfd from loop");
 		return ret;
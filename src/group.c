@@ -0,0 +1,130 @@
+#include <group.h>
+
+static void *group_worker_run(void *arg)
+{
+	struct neutron_loop_group_worker *worker = arg;
+
+	while (__atomic_load_n(&worker->group->running, __ATOMIC_ACQUIRE))
+		neutron_loop_spin(worker->loop);
+
+	return NULL;
+}
+
+struct neutron_loop_group *
+neutron_loop_group_create(uint32_t count,
+			  const struct neutron_loop_options *options)
+{
+	if (count == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		count = ncpu > 0 ? (uint32_t)ncpu : 1;
+	}
+
+	struct neutron_loop_group *group =
+		calloc(1, sizeof(struct neutron_loop_group));
+	if (!group) {
+		LOG_ERRNO("Failure: cannot allocate memory for loop group");
+		return NULL;
+	}
+
+	group->workers =
+		calloc(count, sizeof(struct neutron_loop_group_worker));
+	if (!group->workers) {
+		LOG_ERRNO("Failure: cannot allocate memory for group workers");
+		free(group);
+		return NULL;
+	}
+	group->count = count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		group->workers[i].group = group;
+		group->workers[i].loop =
+			neutron_loop_create_with_options(options);
+		if (!group->workers[i].loop) {
+			LOGE("Failed to create loop %u of the group", i);
+			neutron_loop_group_destroy(group);
+			return NULL;
+		}
+	}
+
+	return group;
+}
+
+uint32_t neutron_loop_group_get_count(struct neutron_loop_group *group)
+{
+	return group ? group->count : 0;
+}
+
+struct neutron_loop *
+neutron_loop_group_get_loop(struct neutron_loop_group *group, uint32_t index)
+{
+	if (!group || index >= group->count)
+		return NULL;
+	return group->workers[index].loop;
+}
+
+int neutron_loop_group_start(struct neutron_loop_group *group)
+{
+	int ret = 0;
+
+	if (!group) {
+		LOGE("Failure: loop group is null");
+		return EINVAL;
+	}
+
+	if (__atomic_exchange_n(&group->running, 1, __ATOMIC_ACQ_REL))
+		return EALREADY;
+
+	for (uint32_t i = 0; i < group->count; i++) {
+		struct neutron_loop_group_worker *worker = &group->workers[i];
+
+		ret = pthread_create(
+			&worker->thread, NULL, group_worker_run, worker);
+		if (ret) {
+			errno = ret;
+			LOG_ERRNO("pthread_create");
+			neutron_loop_group_stop(group);
+			return ret;
+		}
+		worker->started = 1;
+	}
+
+	return 0;
+}
+
+int neutron_loop_group_stop(struct neutron_loop_group *group)
+{
+	if (!group) {
+		LOGE("Failure: loop group is null");
+		return EINVAL;
+	}
+
+	__atomic_store_n(&group->running, 0, __ATOMIC_RELEASE);
+
+	for (uint32_t i = 0; i < group->count; i++) {
+		struct neutron_loop_group_worker *worker = &group->workers[i];
+		if (!worker->started)
+			continue;
+
+		neutron_loop_wakeup(worker->loop);
+		pthread_join(worker->thread, NULL);
+		worker->started = 0;
+	}
+
+	return 0;
+}
+
+void neutron_loop_group_destroy(struct neutron_loop_group *group)
+{
+	if (group) {
+		neutron_loop_group_stop(group);
+
+		for (uint32_t i = 0; i < group->count; i++) {
+			if (group->workers[i].loop)
+				neutron_loop_destroy(group->workers[i].loop);
+		}
+
+		free(group->workers);
+		free(group);
+		group = NULL;
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef _GROUP_H_
+#define _GROUP_H_
+
+#include <neutron_priv.h>
+#include <neutron.h>
+#include <pthread.h>
+
+struct neutron_loop_group_worker {
+	struct neutron_loop_group *group;
+
+	struct neutron_loop *loop;
+
+	pthread_t thread;
+	int started;
+};
+
+struct neutron_loop_group {
+	struct neutron_loop_group_worker *workers;
+	uint32_t count;
+
+	int running;
+};
+
+static inline int group_running(struct neutron_loop_group *group)
+{
+	return __atomic_load_n(&group->running, __ATOMIC_ACQUIRE);
+}
+
+#endif /* _GROUP_H_ */
@@ -13,6 +13,10 @@ static inline uint32_t neutron_events_to_epoll(uint32_t neutron_event)
 		epoll_flag |= EPOLLOUT;
 	if (neutron_event & NEUTRON_FD_EVENT_PRI)
 		epoll_flag |= EPOLLPRI;
+	if (neutron_event & NEUTRON_FD_EVENT_ET)
+		epoll_flag |= EPOLLET;
+	if (neutron_event & NEUTRON_FD_EVENT_ONESHOT)
+		epoll_flag |= EPOLLONESHOT;
 
 	return epoll_flag;
 }
@@ -34,11 +38,20 @@ static inline uint32_t neutron_events_from_epoll(uint32_t epoll_event)
 	return neutron_flag;
 }
 
+static int neutron_loop_grow_fds(struct neutron_loop *loop, int fd);
+
 static inline void neutron_loop_register_fd(struct neutron_loop *loop,
 					    struct neutron_fd *fd);
 
 struct neutron_loop *neutron_loop_create()
 {
+	return neutron_loop_create_with_options(NULL);
+}
+
+struct neutron_loop *
+neutron_loop_create_with_options(const struct neutron_loop_options *options)
+{
+	struct epoll_event *event = NULL;
 	struct neutron_loop *loop = calloc(1, sizeof(struct neutron_loop));
 	if (!loop) {
 		LOG_ERRNO("cannot create loop");
@@ -46,11 +59,30 @@ struct neutron_loop *neutron_loop_create()
 	}
 	/* init loop flags here */
 	loop->flags = 0;
+	loop->efd = -1;
+	loop->wakeup_fd = -1;
+	loop->uring.fd = -1;
+	loop->backend = NEUTRON_LOOP_BACKEND_EPOLL;
+	loop->tasks.head = &loop->tasks.stub;
+	loop->tasks.tail = &loop->tasks.stub;
+
+	/* size the epoll batch */
+	loop->events_min = MAX_EVENTS;
+	loop->events_max = MAX_EVENTS_LIMIT;
+	if (options) {
+		if (options->max_events)
+			loop->events_min = options->max_events;
+		if (options->max_events_limit)
+			loop->events_max = options->max_events_limit;
+		loop->adaptive = options->adaptive;
+	}
+	if (loop->events_max < loop->events_min)
+		loop->events_max = loop->events_min;
 
-	/* create epoll context */
-	loop->efd = epoll_create1(loop->flags);
-	if (loop->efd < 0) {
-		LOG_ERRNO("cannot create epoll context");
+	loop->events_size = loop->events_min;
+	loop->events = calloc(loop->events_size, sizeof(struct epoll_event));
+	if (!loop->events) {
+		LOG_ERRNO("cannot allocate epoll events array");
 		goto error;
 	}
 
@@ -60,10 +92,24 @@ struct neutron_loop *neutron_loop_create()
 		goto error;
 	}
 
-	struct epoll_event *event = calloc(1, sizeof(struct epoll_event));
+	if (options && options->backend == NEUTRON_LOOP_BACKEND_IO_URING) {
+		if (neutron_uring_init(loop, URING_ENTRIES) == 0) {
+			loop->backend = NEUTRON_LOOP_BACKEND_IO_URING;
+			return loop;
+		}
+		LOGW("io_uring not available, falling back to epoll");
+	}
+
+	/* create epoll context */
+	loop->efd = epoll_create1(loop->flags);
+	if (loop->efd < 0) {
+		LOG_ERRNO("cannot create epoll context");
+		goto error;
+	}
+
+	event = calloc(1, sizeof(struct epoll_event));
 	if (!event) {
 		LOG_ERRNO("cannot calloc memory for epoll_event");
-		free(event);
 		goto error;
 	}
 
@@ -79,6 +125,13 @@ struct neutron_loop *neutron_loop_create()
 
 error:
 	free(event);
+	if (loop) {
+		if (loop->wakeup_fd >= 0)
+			close(loop->wakeup_fd);
+		if (loop->efd >= 0)
+			close(loop->efd);
+		free(loop->events);
+	}
 	free(loop);
 	return NULL;
 }
@@ -91,10 +144,46 @@ int neutron_loop_add(struct neutron_loop *loop,
 {
 	int ret = 0;
 
+	if (fd < 0) {
+		LOGE("cannot add invalid fd=%d to loop", fd);
+		return EINVAL;
+	}
+
+	ret = neutron_loop_grow_fds(loop, fd);
+	if (ret)
+		return ret;
+
+	struct neutron_fd *nfd = calloc(1, sizeof(struct neutron_fd));
+	if (!nfd) {
+		LOG_ERRNO("cannot allocate memory for syskit_fd instance");
+		free(nfd);
+		return errno;
+	}
+	nfd->fd = fd;
+	nfd->events = events;
+	nfd->userdata = userdata;
+	nfd->cb = cb;
+
+	if (loop->backend == NEUTRON_LOOP_BACKEND_IO_URING) {
+		/* stale entry of a closed fd: cancel its pending poll */
+		if (loop->nfds[fd])
+			neutron_uring_remove(loop, loop->nfds[fd]);
+
+		neutron_loop_register_fd(loop, nfd);
+		ret = neutron_uring_add(loop, nfd);
+		if (ret) {
+			LOGE("cannot add fd=%d to io_uring loop", fd);
+			loop->nfds[fd] = NULL;
+			loop->number_fds--;
+			free(nfd);
+		}
+		return ret;
+	}
+
 	struct epoll_event *event = calloc(1, sizeof(struct epoll_event));
 	if (!event) {
 		LOG_ERRNO("cannot calloc memory for epoll_event");
-		free(event);
+		free(nfd);
 		return errno;
 	}
 	event->data.fd = fd;
@@ -102,58 +191,70 @@ int neutron_loop_add(struct neutron_loop *loop,
 
 	ret = epoll_ctl(loop->efd, EPOLL_CTL_ADD, fd, event);
 	if (ret < 0) {
+		ret = errno;
 		LOG_ERRNO("cannot add fd to loop");
-		return errno;
+		free(event);
+		free(nfd);
+		return ret;
 	}
 	free(event);
 
-	struct neutron_fd *nfd = calloc(1, sizeof(struct neutron_fd));
+	neutron_loop_register_fd(loop, nfd);
+
+	return 0;
+}
+
+int neutron_loop_rearm(struct neutron_loop *loop, int fd, uint32_t events)
+{
+	struct neutron_fd *nfd = neutron_loop_find_fd(loop, fd);
 	if (!nfd) {
-		LOG_ERRNO("cannot allocate memory for syskit_fd instance");
-		free(nfd);
-		return errno;
+		LOGE("fd=%d is not registered", fd);
+		return ENOENT;
 	}
-	nfd->fd = fd;
-	nfd->events = events;
-	nfd->userdata = userdata;
-	nfd->cb = cb;
 
-	neutron_loop_register_fd(loop, nfd);
+	if (loop->backend == NEUTRON_LOOP_BACKEND_IO_URING) {
+		nfd->events = events;
+		return neutron_uring_rearm(loop, nfd);
+	}
+
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.data.fd = fd;
+	event.events = neutron_events_to_epoll(events);
+
+	int ret = epoll_ctl(loop->efd, EPOLL_CTL_MOD, fd, &event);
+	if (ret < 0) {
+		LOGE("cannot rearm fd=%d in loop", fd);
+		LOG_ERRNO("epoll_ctl");
+		return errno;
+	}
 
+	nfd->events = events;
 	return 0;
 }
 
 int neutron_loop_remove(struct neutron_loop *loop, int fd)
 {
-	struct neutron_fd *head = loop->nfd;
-	struct neutron_fd *to_remove = NULL;
-
-	/* in case the fd to remove is the head of the list */
-	if (head->fd == fd) {
-		loop->nfd = loop->nfd->next;
-		to_remove = head;
-	} else {
-		while (head->next) {
-			if (head->next->fd == fd)
-				break;
-			head = head->next;
-		}
-
-		if (!head->next) {
-			LOGE("fd=%d is not registered", fd);
-			return ENOENT;
-		}
+	struct neutron_fd *to_remove = neutron_loop_find_fd(loop, fd);
+	if (!to_remove) {
+		LOGE("fd=%d is not registered", fd);
+		return ENOENT;
+	}
 
-		to_remove = head->next;
+	loop->nfds[fd] = NULL;
+	loop->number_fds--;
 
-		head->next = head->next->next;
-		loop->number_fds--;
+	if (loop->backend == NEUTRON_LOOP_BACKEND_IO_URING) {
+		int ret = neutron_uring_remove(loop, to_remove);
+		free(to_remove);
+		return ret;
 	}
 
 	int ret = epoll_ctl(loop->efd, EPOLL_CTL_DEL, fd, NULL);
 	if (ret < 0) {
 		LOGE("cannot remove fd=%d from loop", fd);
 		LOG_ERRNO("epoll_ctl");
+		free(to_remove);
 		return errno;
 	}
 
@@ -163,24 +264,153 @@ int neutron_loop_remove(struct neutron_loop *loop, int fd)
 
 struct neutron_fd *neutron_loop_find_fd(struct neutron_loop *loop, int fd)
 {
-	struct neutron_fd *head = loop->nfd;
-	while (head && head->fd != fd)
-		head = head->next;
-	return head;
+	if (fd < 0 || (size_t)fd >= loop->nfds_size)
+		return NULL;
+	return loop->nfds[fd];
+}
+
+/* Grow the epoll batch when a wait filled it, shrink it after a run of
+ * mostly empty waits. */
+static void neutron_loop_adapt_events(struct neutron_loop *loop,
+				      uint32_t nevents)
+{
+	uint32_t size = loop->events_size;
+
+	if (nevents == loop->events_size) {
+		loop->idle_spins = 0;
+		if (size >= loop->events_max)
+			return;
+		size *= 2;
+		if (size > loop->events_max)
+			size = loop->events_max;
+	} else if (nevents <= loop->events_size / 4) {
+		if (++loop->idle_spins < LOOP_SHRINK_SPINS)
+			return;
+		loop->idle_spins = 0;
+		if (size <= loop->events_min)
+			return;
+		size /= 2;
+		if (size < loop->events_min)
+			size = loop->events_min;
+	} else {
+		loop->idle_spins = 0;
+		return;
+	}
+
+	struct epoll_event *events =
+		realloc(loop->events, size * sizeof(struct epoll_event));
+	if (!events) {
+		/* keep running with the current batch size */
+		LOG_ERRNO("cannot resize epoll events array");
+		return;
+	}
+	loop->events = events;
+	loop->events_size = size;
+}
+
+static void neutron_loop_tasks_push(struct neutron_loop_tasks *tasks,
+				    struct neutron_loop_task *task)
+{
+	__atomic_store_n(&task->next, NULL, __ATOMIC_RELAXED);
+	struct neutron_loop_task *prev =
+		__atomic_exchange_n(&tasks->head, task, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, task, __ATOMIC_RELEASE);
+}
+
+/* Returns NULL when empty or when a producer is between its exchange and
+ * its link: that producer signals the loop again once it is done. */
+static struct neutron_loop_task *
+neutron_loop_tasks_pop(struct neutron_loop_tasks *tasks)
+{
+	struct neutron_loop_task *tail = tasks->tail;
+	struct neutron_loop_task *next =
+		__atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &tasks->stub) {
+		if (!next)
+			return NULL;
+		tasks->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		tasks->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&tasks->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	neutron_loop_tasks_push(tasks, &tasks->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		tasks->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+static void neutron_loop_signal_tasks(struct neutron_loop *loop)
+{
+	if (!__atomic_exchange_n(&loop->tasks.signaled, 1, __ATOMIC_ACQ_REL))
+		neutron_loop_wakeup(loop);
+}
+
+static void neutron_loop_run_tasks(struct neutron_loop *loop)
+{
+	struct neutron_loop_task *task;
+	uint32_t count = 0;
+
+	/* posts from now on must wake the loop again */
+	__atomic_store_n(&loop->tasks.signaled, 0, __ATOMIC_SEQ_CST);
+
+	while ((task = neutron_loop_tasks_pop(&loop->tasks)) != NULL) {
+		(*task->cb)(loop, task->arg);
+		free(task);
+
+		if (++count == LOOP_POST_BATCH) {
+			/* leave the rest for the next spin */
+			neutron_loop_signal_tasks(loop);
+			break;
+		}
+	}
+}
+
+int neutron_loop_post(struct neutron_loop *loop,
+		      neutron_loop_task_cb cb,
+		      void *arg)
+{
+	if (!loop || !cb)
+		return EINVAL;
+
+	struct neutron_loop_task *task = malloc(sizeof(*task));
+	if (!task) {
+		LOG_ERRNO("cannot allocate memory for loop task");
+		return ENOMEM;
+	}
+	task->cb = cb;
+	task->arg = arg;
+
+	neutron_loop_tasks_push(&loop->tasks, task);
+	neutron_loop_signal_tasks(loop);
+	return 0;
 }
 
 int neutron_loop_spin(struct neutron_loop *loop)
 {
 	int ret = 0;
-	struct epoll_event events[16];
-	eventfd_t value;
+	struct epoll_event *events = loop->events;
 	uint32_t nevents = 0;
 
-	memset(events, 0, sizeof(events));
-	nevents = sizeof(events) / sizeof(struct epoll_event);
+	if (loop->backend == NEUTRON_LOOP_BACKEND_IO_URING) {
+		ret = neutron_uring_spin(loop);
+		neutron_loop_run_tasks(loop);
+		return ret;
+	}
 
 	do {
-		ret = epoll_wait(loop->efd, events, nevents, -1);
+		ret = epoll_wait(loop->efd, events, loop->events_size, -1);
 	} while (ret < 0 && errno == EINTR);
 
 	if (ret < 0) {
@@ -204,22 +434,52 @@ int neutron_loop_spin(struct neutron_loop *loop)
 			neutron_loop_find_fd(loop, events[i].data.fd);
 
 		if (nfd != NULL && nfd->cb != NULL)
-			(*nfd->cb)(nfd->fd, nfd->events, nfd->userdata);
+			(*nfd->cb)(nfd->fd, revents, nfd->userdata);
 	}
+
+	if (loop->adaptive)
+		neutron_loop_adapt_events(loop, nevents);
+
+	neutron_loop_run_tasks(loop);
+
 	return 0;
 }
 
 void neutron_loop_destroy(struct neutron_loop *loop)
 {
-	struct neutron_fd **head = &loop->nfd;
-	struct neutron_fd *cur = *head, *next = NULL;
+	if (!loop)
+		return;
+
+	if (loop->wheel) {
+		neutron_wheel_destroy(loop->wheel);
+		loop->wheel = NULL;
+	}
 
-	while (cur != NULL) {
-		next = cur->next;
-		free(cur);
-		cur = next;
+	for (size_t i = 0; i < loop->nfds_size; i++) {
+		free(loop->nfds[i]);
+		loop->nfds[i] = NULL;
 	}
-	*head = NULL;
+	free(loop->nfds);
+	loop->nfds = NULL;
+	loop->nfds_size = 0;
+	free(loop->events);
+	loop->events = NULL;
+	loop->events_size = 0;
+
+	if (loop->backend == NEUTRON_LOOP_BACKEND_IO_URING)
+		neutron_uring_fini(loop);
+
+	/* tasks still queued are dropped without running */
+	struct neutron_loop_task *task;
+	while ((task = neutron_loop_tasks_pop(&loop->tasks)) != NULL)
+		free(task);
+	loop->number_fds = 0;
+
+	if (loop->efd >= 0)
+		close(loop->efd);
+	if (loop->wakeup_fd >= 0)
+		close(loop->wakeup_fd);
+	free(loop);
 }
 
 void neutron_loop_wakeup(struct neutron_loop *loop)
@@ -233,23 +493,51 @@ void neutron_loop_wakeup(struct neutron_loop *loop)
 
 void neutron_loop_display_registered_fds(struct neutron_loop *loop)
 {
-	struct neutron_fd *head = loop->nfd;
-	while (head) {
-		LOGI("fd: %ld", head->fd);
-		head = head->next;
+	for (size_t i = 0; i < loop->nfds_size; i++) {
+		if (loop->nfds[i])
+			LOGI("fd: %ld", loop->nfds[i]->fd);
+	}
+}
+
+enum neutron_loop_backend neutron_loop_get_backend(struct neutron_loop *loop)
+{
+	return loop->backend;
+}
+
+static int neutron_loop_grow_fds(struct neutron_loop *loop, int fd)
+{
+	if ((size_t)fd < loop->nfds_size)
+		return 0;
+
+	size_t size = loop->nfds_size ? loop->nfds_size
+				      : LOOP_FD_TABLE_MIN_SIZE;
+	while (size <= (size_t)fd)
+		size *= 2;
+
+	struct neutron_fd **nfds =
+		realloc(loop->nfds, size * sizeof(struct neutron_fd *));
+	if (!nfds) {
+		LOG_ERRNO("cannot grow fd table of the loop");
+		return ENOMEM;
 	}
+
+	memset(&nfds[loop->nfds_size],
+	       0,
+	       (size - loop->nfds_size) * sizeof(struct neutron_fd *));
+	loop->nfds = nfds;
+	loop->nfds_size = size;
+	return 0;
 }
 
 static inline void neutron_loop_register_fd(struct neutron_loop *loop,
 					    struct neutron_fd *fd)
 {
-	if (loop->number_fds == 0)
-		loop->nfd = fd;
-	else {
-		struct neutron_fd *head = loop->nfd;
-		while (head->next)
-			head = head->next;
-		head->next = fd;
+	/* fd was closed without being removed and the number got reused */
+	if (loop->nfds[fd->fd]) {
+		free(loop->nfds[fd->fd]);
+		loop->number_fds--;
 	}
+
+	loop->nfds[fd->fd] = fd;
 	loop->number_fds++;
 }
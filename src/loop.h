@@ -3,9 +3,17 @@
 
 #include <neutron_priv.h>
 #include <neutron.h>
+#include <uring.h>
+#include <wheel.h>
 
 #define LOOP_WAKEUP_MAGIC 0x35
 #define MAX_EVENTS 16
+#define MAX_EVENTS_LIMIT 1024
+/* number of consecutive under-used waits before the batch shrinks */
+#define LOOP_SHRINK_SPINS 64
+#define LOOP_FD_TABLE_MIN_SIZE 64
+/* maximum number of posted tasks run by one spin */
+#define LOOP_POST_BATCH 256
 
 struct neutron_fd {
 	intptr_t fd;
@@ -13,18 +21,54 @@ struct neutron_fd {
 	void *userdata;
 	neutron_fd_event_cb cb;
 
-	struct neutron_fd *next;
+	/* io_uring backend: request tag and whether a poll is in flight */
+	uint32_t seq;
+	int armed;
+	int retry;
+};
+
+struct neutron_loop_task {
+	struct neutron_loop_task *next;
+	neutron_loop_task_cb cb;
+	void *arg;
+};
+
+/* Intrusive multi-producer single-consumer queue (Vyukov): producers swap
+ * themselves in at head, the loop thread pops from tail. */
+struct neutron_loop_tasks {
+	struct neutron_loop_task *head;
+	struct neutron_loop_task *tail;
+	struct neutron_loop_task stub;
+
+	/* set by the first post after a drain, so only it writes wakeup_fd */
+	int signaled;
 };
 
 struct neutron_loop {
-	struct neutron_fd *nfd; /* Linked list of FDs tracked by the loop */
+	/* Table of FDs tracked by the loop, indexed by fd number */
+	struct neutron_fd **nfds;
+	size_t nfds_size;
 	intptr_t number_fds;
 
 	uint32_t flags;
 	intptr_t efd; /* fd associate with the epoll context of the loop */
 
 	/* eventfd that will be used to force the loop to wakeup */
-	eventfd_t wakeup_fd;
+	int wakeup_fd;
+
+	/* epoll_wait batch, resized between min and max in adaptive mode */
+	struct epoll_event *events;
+	uint32_t events_size, events_min, events_max;
+	uint32_t idle_spins;
+	int adaptive;
+
+	enum neutron_loop_backend backend;
+	struct neutron_uring uring;
+
+	struct neutron_loop_tasks tasks;
+
+	/* timing wheel of the loop, created by the first wheel timer */
+	struct neutron_wheel *wheel;
 };
 
 #endif // ! _LOOP_H_
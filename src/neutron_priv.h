@@ -1,11 +1,21 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <log.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <netinet/udp.h>
+#include <net/if.h>
 #include <sys/un.h>
 #include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/errqueue.h>
+#include <poll.h>
 #include <string.h>
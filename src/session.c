@@ -0,0 +1,252 @@
+#include <session.h>
+#include <conn.h>
+#include <ctx.h>
+#include <wheel.h>
+
+static uint32_t session_hash(const struct sockaddr_storage *ss,
+			     socklen_t sslen)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+	uint64_t key, half[2];
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		key = (uint64_t)sin->sin_addr.s_addr << 16 | sin->sin_port;
+		break;
+	case AF_INET6:
+		memcpy(half, &sin6->sin6_addr, sizeof(half));
+		key = half[0] ^ (half[1] * 0x9e3779b97f4a7c15ULL)
+		      ^ ((uint64_t)sin6->sin6_scope_id << 16) ^ sin6->sin6_port;
+		break;
+	default:
+		/* FNV-1a over the whole address */
+		key = 0xcbf29ce484222325ULL;
+		for (socklen_t i = 0; i < sslen; i++)
+			key = (key ^ ((const uint8_t *)ss)[i])
+			      * 0x100000001b3ULL;
+		break;
+	}
+
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static int session_addr_equal(const struct neutron_conn *conn,
+			      const struct sockaddr_storage *ss,
+			      socklen_t sslen)
+{
+	const struct sockaddr_storage *peer = conn->peer;
+
+	if (peer->ss_family != ss->ss_family)
+		return 0;
+
+	switch (ss->ss_family) {
+	case AF_INET: {
+		const struct sockaddr_in *a = (const struct sockaddr_in *)peer;
+		const struct sockaddr_in *b = (const struct sockaddr_in *)ss;
+		return a->sin_port == b->sin_port
+		       && a->sin_addr.s_addr == b->sin_addr.s_addr;
+	}
+	case AF_INET6: {
+		const struct sockaddr_in6 *a =
+			(const struct sockaddr_in6 *)peer;
+		const struct sockaddr_in6 *b = (const struct sockaddr_in6 *)ss;
+		return a->sin6_port == b->sin6_port
+		       && a->sin6_scope_id == b->sin6_scope_id
+		       && !memcmp(&a->sin6_addr,
+				  &b->sin6_addr,
+				  sizeof(a->sin6_addr));
+	}
+	default:
+		return conn->peer_addrlen == sslen && !memcmp(peer, ss, sslen);
+	}
+}
+
+static void session_unlink_active(struct neutron_session_table *table,
+				  struct neutron_conn *conn)
+{
+	if (conn->session.older)
+		conn->session.older->session.newer = conn->session.newer;
+	else
+		table->oldest = conn->session.newer;
+
+	if (conn->session.newer)
+		conn->session.newer->session.older = conn->session.older;
+	else
+		table->newest = conn->session.older;
+
+	conn->session.older = NULL;
+	conn->session.newer = NULL;
+}
+
+static void session_append_active(struct neutron_session_table *table,
+				  struct neutron_conn *conn)
+{
+	conn->session.older = table->newest;
+	conn->session.newer = NULL;
+	if (table->newest)
+		table->newest->session.newer = conn;
+	else
+		table->oldest = conn;
+	table->newest = conn;
+}
+
+static int session_grow(struct neutron_session_table *table)
+{
+	uint32_t nbuckets = table->nbuckets ? table->nbuckets * 2
+					    : SESSION_BUCKETS_MIN;
+	struct neutron_conn **buckets =
+		calloc(nbuckets, sizeof(struct neutron_conn *));
+	if (!buckets) {
+		LOG_ERRNO("Failed to allocate memory for session buckets");
+		return ENOMEM;
+	}
+
+	for (uint32_t i = 0; i < table->nbuckets; i++) {
+		struct neutron_conn *conn = table->buckets[i], *next;
+		for (; conn; conn = next) {
+			next = conn->session.chain;
+			uint32_t b = conn->session.hash & (nbuckets - 1);
+			conn->session.chain = buckets[b];
+			buckets[b] = conn;
+		}
+	}
+
+	free(table->buckets);
+	table->buckets = buckets;
+	table->nbuckets = nbuckets;
+	return 0;
+}
+
+static void session_close(struct neutron_ctx *ctx,
+			  struct neutron_conn *conn,
+			  int notify)
+{
+	struct neutron_session_table *table = &ctx->sessions;
+	struct neutron_conn **link =
+		&table->buckets[conn->session.hash & (table->nbuckets - 1)];
+
+	while (*link != conn)
+		link = &(*link)->session.chain;
+	*link = conn->session.chain;
+
+	session_unlink_active(table, conn);
+	table->count--;
+
+	if (notify)
+		neutron_ctx_notify_event(ctx, NEUTRON_EVENT_DISCONNECTED, conn);
+
+	/* the socket belongs to the conn of the ctx */
+	conn->fd = -1;
+	conn_pool_put(ctx, conn);
+}
+
+static void session_expire_cb(struct neutron_timer *timer, void *userdata)
+{
+	struct neutron_ctx *ctx = userdata;
+	struct neutron_session_table *table = &ctx->sessions;
+	uint64_t now = neutron_wheel_clock_ns();
+	uint64_t idle_ns = (uint64_t)table->idle_ms * 1000000ULL;
+
+	while (table->oldest
+	       && now - table->oldest->session.active_ns >= idle_ns)
+		session_close(ctx, table->oldest, 1);
+}
+
+int session_enable(struct neutron_ctx *ctx, uint32_t idle_ms)
+{
+	struct neutron_session_table *table = &ctx->sessions;
+
+	table->enabled = 1;
+	table->idle_ms = idle_ms;
+
+	if (!idle_ms) {
+		if (table->timer)
+			neutron_timer_clear(table->timer);
+		return 0;
+	}
+
+	if (!table->timer) {
+		table->timer = neutron_timer_create_with_flags(
+			ctx->loop, NEUTRON_TIMER_WHEEL, session_expire_cb, ctx);
+		if (!table->timer)
+			return ENOMEM;
+	}
+
+	/* sessions outlive their timeout by up to a quarter of it */
+	uint32_t period = idle_ms / 4 ? idle_ms / 4 : 1;
+	return neutron_timer_set_periodic(table->timer, period, period);
+}
+
+struct neutron_conn *session_get(struct neutron_ctx *ctx,
+				 struct neutron_conn *conn,
+				 const struct sockaddr_storage *ss,
+				 socklen_t sslen,
+				 uint64_t now_ns)
+{
+	struct neutron_session_table *table = &ctx->sessions;
+	uint32_t hash = session_hash(ss, sslen);
+	struct neutron_conn *session;
+
+	if (table->nbuckets) {
+		session = table->buckets[hash & (table->nbuckets - 1)];
+		for (; session; session = session->session.chain) {
+			if (session->session.hash == hash
+			    && session_addr_equal(session, ss, sslen))
+				break;
+		}
+
+		if (session) {
+			session->session.active_ns = now_ns;
+			if (session != table->newest) {
+				session_unlink_active(table, session);
+				session_append_active(table, session);
+			}
+			return session;
+		}
+	}
+
+	if (table->count >= table->nbuckets && session_grow(table))
+		return NULL;
+
+	session = conn_pool_get(ctx);
+	if (!session)
+		return NULL;
+
+	/* the reply address is interned in the conn */
+	session->fd = conn->fd;
+	session->remove = 0;
+	session->ctx = ctx;
+	session->local = conn->local;
+	session->local_addlren = conn->local_addlren;
+	memcpy(session->peer, ss, sslen);
+	session->peer_addrlen = sslen;
+
+	uint32_t b = hash & (table->nbuckets - 1);
+	session->session.hash = hash;
+	session->session.active_ns = now_ns;
+	session->session.chain = table->buckets[b];
+	table->buckets[b] = session;
+	session_append_active(table, session);
+	table->count++;
+
+	neutron_ctx_notify_event(ctx, NEUTRON_EVENT_CONNECTED, session);
+	return session;
+}
+
+void session_clear(struct neutron_ctx *ctx, int notify)
+{
+	struct neutron_session_table *table = &ctx->sessions;
+
+	while (table->oldest)
+		session_close(ctx, table->oldest, notify);
+
+	if (table->timer) {
+		neutron_timer_destroy(table->timer);
+		table->timer = NULL;
+	}
+
+	free(table->buckets);
+	table->buckets = NULL;
+	table->nbuckets = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <neutron_priv.h>
+#include <neutron.h>
+
+#define SESSION_BUCKETS_MIN 64
+
+/* peers of a datagram ctx, hashed on their address. The conns are chained
+ * in their bucket and kept from least to most recently active. */
+struct neutron_session_table {
+	uint8_t enabled;
+	struct neutron_conn **buckets;
+	uint32_t nbuckets;
+	uint32_t count;
+
+	uint32_t idle_ms;
+	struct neutron_conn *oldest, *newest;
+	struct neutron_timer *timer;
+};
+
+int session_enable(struct neutron_ctx *ctx, uint32_t idle_ms);
+
+/* session conn of the sender, created on its first datagram, NULL when it
+ * could not be allocated */
+struct neutron_conn *session_get(struct neutron_ctx *ctx,
+				 struct neutron_conn *conn,
+				 const struct sockaddr_storage *ss,
+				 socklen_t sslen,
+				 uint64_t now_ns);
+
+/* closes every session, notify reports them disconnected */
+void session_clear(struct neutron_ctx *ctx, int notify);
+
+#endif
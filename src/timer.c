@@ -1,22 +1,58 @@
 #include <neutron.h>
 #include <timer.h>
 
+static inline void timer_notify(struct neutron_timer *timer, uint64_t count)
+{
+	if (timer->overrun_cb)
+		(*timer->overrun_cb)(timer, count, timer->userdata);
+	else if (timer->cb)
+		(*timer->cb)(timer, timer->userdata);
+}
+
+/* Deliver count expirations according to the overrun policy. The timer
+ * may be re-armed, cleared or destroyed from its callback. */
+static void timer_dispatch(struct neutron_timer *timer, uint64_t count)
+{
+	uint32_t generation = timer->generation;
+
+	timer->dispatching = 1;
+	switch (timer->policy) {
+	case NEUTRON_TIMER_OVERRUN_CATCH_UP:
+		/* stop once the callback re-armed, cleared or destroyed it */
+		for (uint64_t i = 0; i < count; i++) {
+			if (timer->destroyed || timer->generation != generation)
+				break;
+			timer_notify(timer, 1);
+		}
+		break;
+	case NEUTRON_TIMER_OVERRUN_SKIP:
+		timer_notify(timer, 1);
+		break;
+	case NEUTRON_TIMER_OVERRUN_COALESCE:
+	default:
+		timer_notify(timer, count);
+		break;
+	}
+	timer->dispatching = 0;
+
+	if (timer->destroyed)
+		free(timer);
+}
+
 static void timer_fd_cb(int fd, uint32_t revents, void *userdata)
 {
 	struct neutron_timer *timer = userdata;
 	uint64_t val;
 	int ret;
 
-	/* TODO: read from timerfd and check validity of value */
 	do {
 		ret = read(timer->tfd, &val, sizeof(val));
 	} while (ret < 0 && errno == EINTR);
 
 	if (ret < 0) {
-		if (errno == EAGAIN)
-			LOGW("Timer is empty");
-		else
-			LOGE("Timer error");
+		/* re-armed between the wakeup and the read */
+		if (errno != EAGAIN)
+			LOG_ERRNO("Timer error");
 		return;
 	}
 
@@ -30,15 +66,10 @@ static void timer_fd_cb(int fd, uint32_t revents, void *userdata)
 		return;
 	}
 
-	if (!val) {
-		LOGE("Callback without timer expiration: this should not happen");
-	}
-
-	if (val > 1)
-		LOGW("Timer expirations missed: %lu", val - 1);
+	if (!val)
+		return;
 
-	if (timer->cb)
-		(*timer->cb)(timer, timer->userdata);
+	timer_dispatch(timer, val);
 }
 
 struct neutron_timer *neutron_timer_create(neutron_timer_cb cb, void *userdata)
@@ -55,6 +86,14 @@ struct neutron_timer *neutron_timer_create(neutron_timer_cb cb, void *userdata)
 struct neutron_timer *neutron_timer_create_with_loop(struct neutron_loop *loop,
 						     neutron_timer_cb cb,
 						     void *userdata)
+{
+	return neutron_timer_create_with_flags(loop, 0, cb, userdata);
+}
+
+struct neutron_timer *neutron_timer_create_with_flags(struct neutron_loop *loop,
+						      uint32_t flags,
+						      neutron_timer_cb cb,
+						      void *userdata)
 {
 	if (!loop) {
 		LOGE("Failure: loop is null");
@@ -73,12 +112,21 @@ struct neutron_timer *neutron_timer_create_with_loop(struct neutron_loop *loop,
 	timer->cb = cb;
 	timer->userdata = userdata;
 	timer->tfd = -1;
+	timer->flags = flags;
+
+	if (flags & NEUTRON_TIMER_WHEEL) {
+		timer->wheel = neutron_wheel_get(loop);
+		if (!timer->wheel)
+			goto clean;
+		return timer;
+	}
 
 	timer->tfd =
 		timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
 
 	if (timer->tfd < 0) {
 		LOG_ERRNO("Failed to create timer fd");
+		goto clean;
 	}
 
 	ret = neutron_loop_add(timer->loop,
@@ -86,8 +134,11 @@ struct neutron_timer *neutron_timer_create_with_loop(struct neutron_loop *loop,
 			       timer_fd_cb,
 			       NEUTRON_FD_EVENT_IN,
 			       (void *)timer);
-	if (ret < 0)
+	if (ret) {
+		close(timer->tfd);
+		timer->tfd = -1;
 		goto clean;
+	}
 
 	return timer;
 
@@ -105,26 +156,124 @@ struct neutron_loop *neutron_timer_get_loop(struct neutron_timer *timer)
 void neutron_timer_destroy(struct neutron_timer *timer)
 {
 	if (timer) {
-		close(timer->tfd);
+		if (timer->wheel)
+			neutron_wheel_remove(timer->wheel, timer);
+		/* io_uring keeps polling a closed fd, remove it first */
+		if (timer->tfd >= 0) {
+			neutron_loop_remove(timer->loop, timer->tfd);
+			close(timer->tfd);
+		}
 		timer->tfd = -1;
+
+		/* freed by timer_dispatch once the callback returns */
+		if (timer->dispatching) {
+			timer->destroyed = 1;
+			return;
+		}
 		free(timer);
 		timer = NULL;
 	}
 }
 
-int neutron_timer_fd_set(struct neutron_timer *timer,
-			 uint32_t delay,
-			 uint32_t period)
+static inline void timer_ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/* round up so that a wheel timer never fires early */
+static inline uint64_t timer_ns_to_tick(uint64_t ns)
+{
+	return (ns + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+}
+
+/* Push the deadline to the coarsest power of two boundary inside its slack
+ * window, so that timers with overlapping windows expire together. */
+static inline uint64_t timer_apply_slack(uint64_t deadline, uint64_t slack)
+{
+	uint64_t limit = deadline + slack;
+	uint64_t mask = deadline ^ limit;
+
+	if (slack == 0 || mask == 0)
+		return deadline;
+
+	mask = (1ULL << (63 - __builtin_clzll(mask))) - 1;
+	return limit & ~mask;
+}
+
+static int timer_wheel_arm(struct neutron_timer *timer,
+			   uint64_t deadline,
+			   uint64_t period)
+{
+	timer->deadline = deadline;
+	timer->period_ns = period;
+	neutron_wheel_add(
+		timer->wheel,
+		timer,
+		timer_ns_to_tick(timer_apply_slack(deadline, timer->slack)));
+	return 0;
+}
+
+void neutron_timer_wheel_expired(struct neutron_timer *timer)
+{
+	uint64_t count = 1;
+
+	/* re-insert before the callback so that it may clear the timer. The
+	 * schedule advances from the previous deadline so it does not drift,
+	 * periods that already passed are counted as overruns */
+	if (timer->period_ns) {
+		uint64_t now = neutron_wheel_clock_ns();
+		timer->deadline += timer->period_ns;
+		if (timer->deadline <= now) {
+			uint64_t missed =
+				(now - timer->deadline) / timer->period_ns + 1;
+			timer->deadline += missed * timer->period_ns;
+			count += missed;
+		}
+		neutron_wheel_add(timer->wheel,
+				  timer,
+				  timer_ns_to_tick(timer_apply_slack(
+					  timer->deadline, timer->slack)));
+	}
+
+	timer_dispatch(timer, count);
+}
+
+/* Arm the timer for value nanoseconds from now, or at value on
+ * CLOCK_MONOTONIC when abs is set. A zero value disarms it. */
+static int timer_arm(struct neutron_timer *timer,
+		     uint64_t value,
+		     uint64_t period,
+		     int abs)
 {
 	struct itimerspec new_val;
 
-	new_val.it_value.tv_sec = (long int)(delay / 1000);
-	new_val.it_value.tv_nsec = (delay % 1000) * 1e+6;
+	timer->generation++;
 
-	new_val.it_interval.tv_sec = (long int)(period / 1000);
-	new_val.it_interval.tv_nsec = (long int)(period % 1000) * 1e+6;
+	if (timer->flags & NEUTRON_TIMER_WHEEL) {
+		if (value == 0) {
+			neutron_wheel_remove(timer->wheel, timer);
+			return 0;
+		}
+		if (!abs)
+			value += neutron_wheel_clock_ns();
+		return timer_wheel_arm(timer, value, period);
+	}
 
-	int ret = timerfd_settime(timer->tfd, 0, &new_val, NULL);
+	/* with slack the first expiry is aligned on an absolute boundary, the
+	 * kernel keeps the period from there */
+	if (value && timer->slack) {
+		if (!abs)
+			value += neutron_wheel_clock_ns();
+		value = timer_apply_slack(value, timer->slack);
+		abs = 1;
+	}
+
+	timer_ns_to_timespec(value, &new_val.it_value);
+	timer_ns_to_timespec(period, &new_val.it_interval);
+
+	int ret = timerfd_settime(
+		timer->tfd, abs ? TFD_TIMER_ABSTIME : 0, &new_val, NULL);
 	if (ret < 0) {
 		ret = errno;
 		LOG_ERRNO("Failure: timerfd_settime");
@@ -132,6 +281,67 @@ int neutron_timer_fd_set(struct neutron_timer *timer,
 	return ret;
 }
 
+int neutron_timer_fd_set(struct neutron_timer *timer,
+			 uint32_t delay,
+			 uint32_t period)
+{
+	return timer_arm(timer, delay * 1000000ULL, period * 1000000ULL, 0);
+}
+
+int neutron_timer_set_ns(struct neutron_timer *timer,
+			 uint64_t delay_ns,
+			 uint64_t period_ns)
+{
+	if (!timer) {
+		LOGE("Failure: timer is null");
+		return EINVAL;
+	}
+	return timer_arm(timer, delay_ns, period_ns, 0);
+}
+
+int neutron_timer_set_abs(struct neutron_timer *timer,
+			  uint64_t deadline_ns,
+			  uint64_t period_ns)
+{
+	if (!timer || deadline_ns == 0) {
+		LOGE("Failure: invalid timer or deadline");
+		return EINVAL;
+	}
+	return timer_arm(timer, deadline_ns, period_ns, 1);
+}
+
+int neutron_timer_set_slack(struct neutron_timer *timer, uint64_t slack_ns)
+{
+	if (!timer) {
+		LOGE("Failure: timer is null");
+		return EINVAL;
+	}
+	timer->slack = slack_ns;
+	return 0;
+}
+
+int neutron_timer_set_overrun_cb(struct neutron_timer *timer,
+				 neutron_timer_overrun_cb cb)
+{
+	if (!timer) {
+		LOGE("Failure: timer is null");
+		return EINVAL;
+	}
+	timer->overrun_cb = cb;
+	return 0;
+}
+
+int neutron_timer_set_overrun_policy(struct neutron_timer *timer,
+				     enum neutron_timer_overrun_policy policy)
+{
+	if (!timer) {
+		LOGE("Failure: timer is null");
+		return EINVAL;
+	}
+	timer->policy = policy;
+	return 0;
+}
+
 int neutron_timer_set(struct neutron_timer *timer, uint32_t delay)
 {
 	return neutron_timer_fd_set(timer, delay, 0);
@@ -3,6 +3,7 @@
 
 #include <neutron_priv.h>
 #include <neutron.h>
+#include <wheel.h>
 
 struct neutron_timer {
 	uint32_t delay, period;
@@ -14,8 +15,30 @@ struct neutron_timer {
 	void *userdata;
 
 	neutron_timer_cb cb;
+
+	neutron_timer_overrun_cb overrun_cb;
+	enum neutron_timer_overrun_policy policy;
+
+	/* bumped on every set so catch-up stops once the timer is re-armed */
+	uint32_t generation;
+	int dispatching, destroyed;
+
+	uint32_t flags;
+
+	/* how late the timer may fire, used to coalesce expirations */
+	uint64_t slack;
+
+	/* timing wheel state, only used with NEUTRON_TIMER_WHEEL */
+	struct neutron_wheel *wheel;
+	struct neutron_wheel_link link;
+	uint64_t expiry;           /* in wheel ticks */
+	uint64_t deadline, period_ns; /* CLOCK_MONOTONIC nanoseconds */
+	uint8_t level, slot;
+	int pending;
 };
 
+void neutron_timer_wheel_expired(struct neutron_timer *timer);
+
 int neutron_timer_fd_set(struct neutron_timer *timer,
 			 uint32_t delay,
 			 uint32_t period);
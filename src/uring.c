@@ -0,0 +1,669 @@
+#include <loop.h>
+
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+
+#ifndef IORING_RECV_MULTISHOT
+#define IORING_RECV_MULTISHOT (1U << 1)
+#endif
+
+#ifndef IORING_ACCEPT_MULTISHOT
+#define IORING_ACCEPT_MULTISHOT (1U << 0)
+#endif
+
+static inline int uring_setup(uint32_t entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int uring_enter(int fd,
+			      uint32_t to_submit,
+			      uint32_t min_complete,
+			      uint32_t flags)
+{
+	return (int)syscall(
+		__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int uring_register(int fd,
+				 uint32_t opcode,
+				 void *arg,
+				 uint32_t nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline uint32_t uring_poll_mask(uint32_t events)
+{
+	uint32_t mask = 0;
+	if (events & NEUTRON_FD_EVENT_IN)
+		mask |= POLLIN;
+	if (events & NEUTRON_FD_EVENT_PRI)
+		mask |= POLLPRI;
+	if (events & NEUTRON_FD_EVENT_OUT)
+		mask |= POLLOUT;
+
+	return mask;
+}
+
+static inline uint32_t uring_events_from_poll(uint32_t mask)
+{
+	uint32_t events = 0;
+	if (mask & POLLIN)
+		events |= NEUTRON_FD_EVENT_IN;
+	if (mask & POLLOUT)
+		events |= NEUTRON_FD_EVENT_OUT;
+	if (mask & POLLERR)
+		events |= NEUTRON_FD_EVENT_ERROR;
+	if (mask & POLLHUP)
+		events |= NEUTRON_FD_EVENT_HUP;
+	if (mask & POLLPRI)
+		events |= NEUTRON_FD_EVENT_PRI;
+
+	return events;
+}
+
+static inline uint64_t uring_udata(struct neutron_fd *nfd)
+{
+	return ((uint64_t)nfd->seq << 32) | (uint32_t)nfd->fd;
+}
+
+static inline uint32_t uring_pending(struct neutron_uring *ring)
+{
+	return *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static int uring_submit(struct neutron_uring *ring, uint32_t min_complete)
+{
+	int ret;
+	uint32_t flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+	do {
+		ret = uring_enter(
+			ring->fd, uring_pending(ring), min_complete, flags);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return errno;
+
+	return 0;
+}
+
+static int uring_queue(struct neutron_uring *ring,
+		       const struct io_uring_sqe *sqe)
+{
+	/* flush pending requests when the submission queue is full */
+	if (uring_pending(ring) >= ring->sq_entries) {
+		int ret = uring_submit(ring, 0);
+		if (ret) {
+			errno = ret;
+			LOG_ERRNO("io_uring_enter");
+			return ret;
+		}
+		if (uring_pending(ring) >= ring->sq_entries)
+			return EBUSY;
+	}
+
+	uint32_t tail = *ring->sq_tail;
+	uint32_t index = tail & *ring->sq_mask;
+
+	ring->sqes[index] = *sqe;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static int uring_arm_wakeup(struct neutron_loop *loop)
+{
+	struct io_uring_sqe sqe;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = loop->wakeup_fd;
+	sqe.poll32_events = POLLIN;
+	sqe.user_data = URING_UDATA_WAKEUP;
+
+	return uring_queue(&loop->uring, &sqe);
+}
+
+static int uring_arm(struct neutron_loop *loop, struct neutron_fd *nfd)
+{
+	struct io_uring_sqe sqe;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_POLL_ADD;
+	sqe.fd = nfd->fd;
+	sqe.poll32_events = uring_poll_mask(nfd->events);
+	sqe.user_data = uring_udata(nfd);
+
+	/* edge-triggered fds keep one multishot poll armed, the others are
+	 * polled again after each dispatch */
+	if ((nfd->events & NEUTRON_FD_EVENT_ET)
+	    && !(nfd->events & NEUTRON_FD_EVENT_ONESHOT))
+		sqe.len = IORING_POLL_ADD_MULTI;
+
+	int ret = uring_queue(&loop->uring, &sqe);
+	if (ret)
+		return ret;
+
+	nfd->armed = 1;
+	return 0;
+}
+
+static int uring_disarm(struct neutron_loop *loop, struct neutron_fd *nfd)
+{
+	struct io_uring_sqe sqe;
+
+	if (!nfd->armed)
+		return 0;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_POLL_REMOVE;
+	sqe.fd = -1;
+	sqe.addr = uring_udata(nfd);
+	sqe.user_data = URING_UDATA_IGNORE;
+
+	nfd->armed = 0;
+	return uring_queue(&loop->uring, &sqe);
+}
+
+int neutron_uring_init(struct neutron_loop *loop, uint32_t entries)
+{
+	int ret = 0;
+	struct neutron_uring *ring = &loop->uring;
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = uring_setup(entries, &params);
+	if (ring->fd < 0) {
+		ret = errno;
+		LOG_ERRNO("io_uring_setup");
+		return ret;
+	}
+
+	ring->sq_entries = params.sq_entries;
+	ring->sq_ring_size =
+		params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = params.cq_off.cqes
+			     + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL,
+			     ring->sq_ring_size,
+			     PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE,
+			     ring->fd,
+			     IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		LOG_ERRNO("cannot map io_uring submission queue");
+		goto error;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL,
+				     ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE,
+				     ring->fd,
+				     IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			LOG_ERRNO("cannot map io_uring completion queue");
+			goto error;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL,
+			  ring->sqes_size,
+			  PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE,
+			  ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		LOG_ERRNO("cannot map io_uring submission entries");
+		goto error;
+	}
+
+	ring->sq_head = (uint32_t *)((char *)ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (uint32_t *)((char *)ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask =
+		(uint32_t *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array =
+		(uint32_t *)((char *)ring->sq_ring + params.sq_off.array);
+
+	ring->cq_head = (uint32_t *)((char *)ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (uint32_t *)((char *)ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask =
+		(uint32_t *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring
+					     + params.cq_off.cqes);
+
+	ret = uring_arm_wakeup(loop);
+	if (ret) {
+		LOGE("cannot poll wakeup fd with io_uring");
+		neutron_uring_fini(loop);
+		return ret;
+	}
+
+	return 0;
+
+error:
+	ret = errno;
+	neutron_uring_fini(loop);
+	return ret;
+}
+
+void neutron_uring_fini(struct neutron_loop *loop)
+{
+	struct neutron_uring *ring = &loop->uring;
+
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	if (ring->br)
+		munmap(ring->br, ring->br_size);
+	free(ring->bufs);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+int neutron_uring_add(struct neutron_loop *loop, struct neutron_fd *nfd)
+{
+	nfd->seq = ++loop->uring.seq & URING_SEQ_MASK;
+	return uring_arm(loop, nfd);
+}
+
+int neutron_uring_rearm(struct neutron_loop *loop, struct neutron_fd *nfd)
+{
+	int ret = uring_disarm(loop, nfd);
+	if (ret)
+		return ret;
+
+	nfd->seq = ++loop->uring.seq & URING_SEQ_MASK;
+	return uring_arm(loop, nfd);
+}
+
+int neutron_uring_remove(struct neutron_loop *loop, struct neutron_fd *nfd)
+{
+	return uring_disarm(loop, nfd);
+}
+
+static void uring_dispatch(struct neutron_loop *loop,
+			   const struct io_uring_cqe *cqe)
+{
+	uint64_t value;
+
+	if (cqe->user_data == URING_UDATA_IGNORE)
+		return;
+
+	if (cqe->user_data == URING_UDATA_WAKEUP) {
+		read(loop->wakeup_fd, &value, sizeof(value));
+		if (uring_arm_wakeup(loop))
+			loop->uring.retry = loop->uring.retry_wakeup = 1;
+		return;
+	}
+
+	if (cqe->user_data & URING_UDATA_OP) {
+		struct neutron_uring_op *op =
+			(struct neutron_uring_op *)(uintptr_t)(cqe->user_data
+							       & ~URING_UDATA_OP);
+		(*op->cb)(op, cqe->res, cqe->flags);
+		return;
+	}
+
+	int fd = (int)(uint32_t)cqe->user_data;
+	uint32_t seq = (uint32_t)(cqe->user_data >> 32);
+
+	/* the fd was removed or re-armed since the request was queued */
+	struct neutron_fd *nfd = neutron_loop_find_fd(loop, fd);
+	if (!nfd || nfd->seq != seq)
+		return;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		nfd->armed = 0;
+
+	uint32_t revents;
+	if (cqe->res < 0) {
+		if (cqe->res == -ECANCELED)
+			return;
+		errno = -cqe->res;
+		LOG_ERRNO("io_uring poll");
+		revents = NEUTRON_FD_EVENT_ERROR;
+	} else {
+		revents = uring_events_from_poll(cqe->res);
+	}
+
+	if (revents && nfd->cb != NULL)
+		(*nfd->cb)(fd, revents, nfd->userdata);
+
+	/* poll again unless the callback removed or re-armed the fd */
+	nfd = neutron_loop_find_fd(loop, fd);
+	if (nfd && nfd->seq == seq && !nfd->armed
+	    && !(nfd->events & NEUTRON_FD_EVENT_ONESHOT)
+	    && uring_arm(loop, nfd))
+		loop->uring.retry = nfd->retry = 1;
+}
+
+/* queues the polls a full submission queue refused earlier */
+static void uring_retry(struct neutron_loop *loop)
+{
+	struct neutron_uring *ring = &loop->uring;
+
+	ring->retry = 0;
+	if (ring->retry_wakeup) {
+		ring->retry_wakeup = 0;
+		if (uring_arm_wakeup(loop))
+			ring->retry = ring->retry_wakeup = 1;
+	}
+
+	for (size_t i = 0; i < loop->nfds_size; i++) {
+		struct neutron_fd *nfd = loop->nfds[i];
+		if (!nfd || !nfd->retry)
+			continue;
+
+		nfd->retry = 0;
+		if (!nfd->armed && uring_arm(loop, nfd))
+			ring->retry = nfd->retry = 1;
+	}
+
+	while (ring->deferred) {
+		struct neutron_uring_op *op = ring->deferred;
+		if (uring_queue(ring, &op->sqe)) {
+			ring->retry = 1;
+			break;
+		}
+		ring->deferred = op->next;
+		op->next = NULL;
+		op->deferred = 0;
+		if (op->cancel)
+			free(op);
+	}
+}
+
+int neutron_uring_spin(struct neutron_loop *loop)
+{
+	struct neutron_uring *ring = &loop->uring;
+
+	if (ring->retry)
+		uring_retry(loop);
+
+	/* submit queued poll requests and wait in a single syscall, without
+	 * blocking while a poll is still missing */
+	int ret = uring_submit(ring, ring->retry ? 0 : 1);
+	if (ret && ret != EBUSY) {
+		errno = ret;
+		LOG_ERRNO("io_uring_enter");
+		return ret;
+	}
+
+	uint32_t head = *ring->cq_head;
+	uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		struct io_uring_cqe cqe = ring->cqes[head & *ring->cq_mask];
+
+		/* release the slot before dispatching, callbacks may queue */
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		uring_dispatch(loop, &cqe);
+	}
+
+	return 0;
+}
+
+/* multishot receive needs 6.0, which also brought zero-copy send */
+static int uring_probe_ops(struct neutron_uring *ring)
+{
+	size_t size = sizeof(struct io_uring_probe)
+		      + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	int ret = 0;
+
+	if (!probe)
+		return 0;
+
+	if (uring_register(ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST)
+		    == 0
+	    && probe->last_op >= IORING_OP_SEND_ZC
+	    && (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+		ret = 1;
+
+	free(probe);
+	return ret;
+}
+
+static void uring_buf_add(struct neutron_uring *ring, uint16_t bid)
+{
+	struct io_uring_buf *buf =
+		&ring->br->bufs[ring->br_tail & (URING_BUF_COUNT - 1)];
+
+	buf->addr = (uint64_t)(uintptr_t)(ring->bufs
+					  + (size_t)bid * URING_BUF_SIZE);
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+
+	ring->br_tail++;
+	__atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+int neutron_uring_ops_supported(struct neutron_loop *loop)
+{
+	struct neutron_uring *ring = &loop->uring;
+	struct io_uring_buf_reg reg;
+
+	if (loop->backend != NEUTRON_LOOP_BACKEND_IO_URING)
+		return 0;
+	if (ring->ops)
+		return ring->ops > 0;
+
+	ring->ops = -1;
+	if (!uring_probe_ops(ring)) {
+		LOGW("io_uring lacks multishot receive, using polls");
+		return 0;
+	}
+
+	ring->br_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+	ring->br = mmap(NULL,
+			ring->br_size,
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS,
+			-1,
+			0);
+	if (ring->br == MAP_FAILED) {
+		ring->br = NULL;
+		LOG_ERRNO("cannot map io_uring buffer ring");
+		return 0;
+	}
+
+	ring->bufs = malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+	if (!ring->bufs) {
+		LOG_ERRNO("cannot allocate io_uring receive buffers");
+		goto error;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->br;
+	reg.ring_entries = URING_BUF_COUNT;
+	reg.bgid = URING_BUF_GROUP;
+	if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		LOG_ERRNO("cannot register io_uring buffer ring");
+		goto error;
+	}
+
+	for (uint16_t bid = 0; bid < URING_BUF_COUNT; bid++)
+		uring_buf_add(ring, bid);
+
+	ring->ops = 1;
+	return 1;
+
+error:
+	munmap(ring->br, ring->br_size);
+	ring->br = NULL;
+	free(ring->bufs);
+	ring->bufs = NULL;
+	return 0;
+}
+
+static void uring_defer(struct neutron_uring *ring,
+			struct neutron_uring_op *op,
+			const struct io_uring_sqe *sqe)
+{
+	op->sqe = *sqe;
+	op->deferred = 1;
+	op->next = NULL;
+
+	struct neutron_uring_op **tail = &ring->deferred;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = op;
+
+	ring->retry = 1;
+}
+
+/* a request refused by a full submission queue waits for the next spin */
+static int uring_queue_op(struct neutron_loop *loop,
+			  struct neutron_uring_op *op,
+			  struct io_uring_sqe *sqe)
+{
+	struct neutron_uring *ring = &loop->uring;
+
+	sqe->user_data = (uint64_t)(uintptr_t)op | URING_UDATA_OP;
+	if (ring->deferred || uring_queue(ring, sqe))
+		uring_defer(ring, op, sqe);
+	return 0;
+}
+
+int neutron_uring_accept(struct neutron_loop *loop,
+			 int fd,
+			 struct neutron_uring_op *op)
+{
+	struct io_uring_sqe sqe;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_ACCEPT;
+	sqe.fd = fd;
+	sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+
+	return uring_queue_op(loop, op, &sqe);
+}
+
+int neutron_uring_recv(struct neutron_loop *loop,
+		       int fd,
+		       struct neutron_uring_op *op)
+{
+	struct io_uring_sqe sqe;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_RECV;
+	sqe.fd = fd;
+	sqe.flags = IOSQE_BUFFER_SELECT;
+	sqe.buf_group = URING_BUF_GROUP;
+	sqe.ioprio = IORING_RECV_MULTISHOT;
+
+	return uring_queue_op(loop, op, &sqe);
+}
+
+int neutron_uring_sendmsg(struct neutron_loop *loop,
+			  int fd,
+			  const struct msghdr *msg,
+			  struct neutron_uring_op *op)
+{
+	struct io_uring_sqe sqe;
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_SENDMSG;
+	sqe.fd = fd;
+	sqe.addr = (uint64_t)(uintptr_t)msg;
+	sqe.len = 1;
+	sqe.msg_flags = MSG_NOSIGNAL;
+
+	return uring_queue_op(loop, op, &sqe);
+}
+
+int neutron_uring_cancel(struct neutron_loop *loop,
+			 struct neutron_uring_op *op)
+{
+	struct neutron_uring *ring = &loop->uring;
+	struct io_uring_sqe sqe;
+
+	if (op->deferred) {
+		struct neutron_uring_op **prev = &ring->deferred;
+		while (*prev != op)
+			prev = &(*prev)->next;
+		*prev = op->next;
+		op->next = NULL;
+		op->deferred = 0;
+		return 1;
+	}
+
+	memset(&sqe, 0, sizeof(sqe));
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = (uint64_t)(uintptr_t)op | URING_UDATA_OP;
+	sqe.user_data = URING_UDATA_IGNORE;
+
+	if (!ring->deferred && uring_queue(ring, &sqe) == 0)
+		return 0;
+
+	/* op keeps tracking its own request, the cancel waits in an op of
+	 * its own */
+	struct neutron_uring_op *cancel = calloc(1, sizeof(*cancel));
+	if (!cancel) {
+		LOG_ERRNO("cannot allocate io_uring cancel");
+		return 0;
+	}
+	cancel->cancel = 1;
+	uring_defer(ring, cancel, &sqe);
+	return 0;
+}
+
+void neutron_uring_forget(struct neutron_loop *loop,
+			  struct neutron_uring_op *op)
+{
+	struct neutron_uring_op **prev = &loop->uring.deferred;
+	uint64_t target = (uint64_t)(uintptr_t)op | URING_UDATA_OP;
+
+	while (*prev) {
+		struct neutron_uring_op *cur = *prev;
+		if (cur->cancel && cur->sqe.addr == target) {
+			*prev = cur->next;
+			free(cur);
+			continue;
+		}
+		prev = &cur->next;
+	}
+}
+
+uint8_t *neutron_uring_buf(struct neutron_loop *loop, uint32_t flags)
+{
+	if (!(flags & IORING_CQE_F_BUFFER))
+		return NULL;
+
+	uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	return loop->uring.bufs + (size_t)bid * URING_BUF_SIZE;
+}
+
+void neutron_uring_buf_put(struct neutron_loop *loop, uint32_t flags)
+{
+	if (flags & IORING_CQE_F_BUFFER)
+		uring_buf_add(&loop->uring, flags >> IORING_CQE_BUFFER_SHIFT);
+}
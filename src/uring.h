@@ -0,0 +1,130 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <neutron_priv.h>
+#include <neutron.h>
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+
+#define URING_ENTRIES 256
+
+/* user_data of requests whose completion is not dispatched */
+#define URING_UDATA_IGNORE UINT64_MAX
+#define URING_UDATA_WAKEUP (UINT64_MAX - 1)
+/* set in the user_data of completion-based requests, which holds their op,
+ * so poll tags stay below it */
+#define URING_UDATA_OP (1ULL << 63)
+#define URING_SEQ_MASK 0x7fffffffU
+
+/* provided buffers of multishot receives, the count is a power of 2 */
+#define URING_BUF_GROUP 0
+#define URING_BUF_COUNT 128
+#define URING_BUF_SIZE 4096
+
+struct neutron_uring_op;
+
+/* flags are the cqe flags, IORING_CQE_F_MORE while a multishot request
+ * stays armed */
+typedef void (*neutron_uring_op_cb)(struct neutron_uring_op *op,
+				    int32_t res,
+				    uint32_t flags);
+
+/* completion-based request, embedded in its owner and alive until its last
+ * completion */
+struct neutron_uring_op {
+	neutron_uring_op_cb cb;
+
+	/* request refused by a full submission queue, queued by the next
+	 * spin */
+	struct io_uring_sqe sqe;
+	struct neutron_uring_op *next;
+	int deferred;
+	/* cancel allocated by the ring for another op, freed once queued */
+	int cancel;
+};
+
+struct neutron_uring {
+	int fd;
+
+	/* submission queue */
+	void *sq_ring;
+	size_t sq_ring_size;
+	uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	uint32_t sq_entries;
+
+	/* completion queue, shares the sq mapping on recent kernels */
+	void *cq_ring;
+	size_t cq_ring_size;
+	uint32_t *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* tags poll requests so stale completions of a reused fd are dropped */
+	uint32_t seq;
+
+	/* polls that could not be queued, armed again by the next spin */
+	int retry;
+	int retry_wakeup;
+	struct neutron_uring_op *deferred;
+
+	/* receive buffers, set up by the first completion-based request;
+	 * ops is 1 once available and -1 if the kernel lacks them */
+	int ops;
+	struct io_uring_buf_ring *br;
+	size_t br_size;
+	uint16_t br_tail;
+	uint8_t *bufs;
+};
+
+int neutron_uring_init(struct neutron_loop *loop, uint32_t entries);
+
+void neutron_uring_fini(struct neutron_loop *loop);
+
+int neutron_uring_add(struct neutron_loop *loop, struct neutron_fd *nfd);
+
+int neutron_uring_rearm(struct neutron_loop *loop, struct neutron_fd *nfd);
+
+int neutron_uring_remove(struct neutron_loop *loop, struct neutron_fd *nfd);
+
+int neutron_uring_spin(struct neutron_loop *loop);
+
+/* whether the kernel takes the requests below: multishot accept and
+ * receive, provided buffers */
+int neutron_uring_ops_supported(struct neutron_loop *loop);
+
+/* multishot accept, res is the non-blocking fd of each connection */
+int neutron_uring_accept(struct neutron_loop *loop,
+			 int fd,
+			 struct neutron_uring_op *op);
+
+/* multishot receive into provided buffers, see neutron_uring_buf() */
+int neutron_uring_recv(struct neutron_loop *loop,
+		       int fd,
+		       struct neutron_uring_op *op);
+
+/* msg and the memory it points to must stay valid until the completion */
+int neutron_uring_sendmsg(struct neutron_loop *loop,
+			  int fd,
+			  const struct msghdr *msg,
+			  struct neutron_uring_op *op);
+
+/* Cancels a queued request, its completion comes with -ECANCELED. Returns
+ * 1 if the request never reached the kernel, it then gets no completion. */
+int neutron_uring_cancel(struct neutron_loop *loop,
+			 struct neutron_uring_op *op);
+
+/* drops the cancels still waiting for room that target op, called before
+ * the memory of op is freed or reused */
+void neutron_uring_forget(struct neutron_loop *loop,
+			  struct neutron_uring_op *op);
+
+/* data of the buffer a receive completion selected, NULL if none */
+uint8_t *neutron_uring_buf(struct neutron_loop *loop, uint32_t flags);
+
+/* hands the buffer of a receive completion back to the kernel */
+void neutron_uring_buf_put(struct neutron_loop *loop, uint32_t flags);
+
+#endif /* _URING_H_ */
@@ -0,0 +1,308 @@
+#include <wheel.h>
+#include <timer.h>
+#include <loop.h>
+
+#define link_to_timer(_link) \
+	((struct neutron_timer *)((char *)(_link) \
+				  - offsetof(struct neutron_timer, link)))
+
+static inline void link_init(struct neutron_wheel_link *head)
+{
+	head->prev = head;
+	head->next = head;
+}
+
+static inline int link_empty(struct neutron_wheel_link *head)
+{
+	return head->next == head;
+}
+
+static inline void link_append(struct neutron_wheel_link *head,
+			       struct neutron_wheel_link *link)
+{
+	link->prev = head->prev;
+	link->next = head;
+	head->prev->next = link;
+	head->prev = link;
+}
+
+static inline void link_unlink(struct neutron_wheel_link *link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = link;
+	link->next = link;
+}
+
+uint64_t neutron_wheel_clock_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t wheel_clock_tick(void)
+{
+	return neutron_wheel_clock_ns() / WHEEL_TICK_NS;
+}
+
+static void wheel_arm(struct neutron_wheel *wheel, uint64_t tick)
+{
+	struct itimerspec val;
+
+	memset(&val, 0, sizeof(val));
+	if (tick) {
+		uint64_t ns = tick * WHEEL_TICK_NS;
+		val.it_value.tv_sec = ns / 1000000000ULL;
+		val.it_value.tv_nsec = ns % 1000000000ULL;
+	}
+
+	if (timerfd_settime(wheel->tfd, TFD_TIMER_ABSTIME, &val, NULL) < 0) {
+		LOG_ERRNO("Failure: timerfd_settime");
+		return;
+	}
+	wheel->armed = tick;
+}
+
+/* First tick after now with something to do: a level 0 expiry or the
+ * cascade of an occupied higher level slot. */
+static uint64_t wheel_next_event(struct neutron_wheel *wheel)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		uint64_t occupied = wheel->occupied[level];
+		if (!occupied)
+			continue;
+
+		unsigned shift = level * WHEEL_BITS;
+		uint64_t base = wheel->now >> shift;
+		unsigned start = (base + 1) & WHEEL_MASK;
+
+		/* rotate so that bit 0 is the slot following the current one */
+		uint64_t rotated = occupied >> start;
+		if (start)
+			rotated |= occupied << (WHEEL_SLOTS - start);
+
+		uint64_t tick = (base + __builtin_ctzll(rotated) + 1) << shift;
+		if (tick < next)
+			next = tick;
+	}
+
+	return next;
+}
+
+/* Tick at which the timer placed at level/slot needs attention */
+static inline uint64_t wheel_event_tick(struct neutron_timer *timer)
+{
+	unsigned shift = timer->level * WHEEL_BITS;
+	return (timer->expiry >> shift) << shift;
+}
+
+static void wheel_place(struct neutron_wheel *wheel,
+			struct neutron_timer *timer)
+{
+	uint64_t delta = timer->expiry - wheel->now;
+	int level = 0;
+
+	if (delta > WHEEL_MAX_TICKS) {
+		delta = WHEEL_MAX_TICKS;
+		timer->expiry = wheel->now + delta;
+	}
+
+	while (level < WHEEL_LEVELS - 1
+	       && delta >= (1ULL << ((level + 1) * WHEEL_BITS)))
+		level++;
+
+	timer->level = level;
+	timer->slot = (timer->expiry >> (level * WHEEL_BITS)) & WHEEL_MASK;
+	link_append(&wheel->slots[level][timer->slot], &timer->link);
+	wheel->occupied[level] |= 1ULL << timer->slot;
+}
+
+static void wheel_unlink(struct neutron_wheel *wheel,
+			 struct neutron_timer *timer)
+{
+	struct neutron_wheel_link *head =
+		&wheel->slots[timer->level][timer->slot];
+
+	link_unlink(&timer->link);
+	if (link_empty(head))
+		wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+
+	timer->pending = 0;
+	wheel->count--;
+}
+
+static void wheel_cascade(struct neutron_wheel *wheel, int level, int slot)
+{
+	struct neutron_wheel_link list;
+	struct neutron_wheel_link *head = &wheel->slots[level][slot];
+
+	if (link_empty(head))
+		return;
+
+	/* move the slot aside, its timers are all due in this block */
+	list = *head;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(head);
+	wheel->occupied[level] &= ~(1ULL << slot);
+
+	while (!link_empty(&list)) {
+		struct neutron_timer *timer = link_to_timer(list.next);
+		link_unlink(&timer->link);
+		wheel_place(wheel, timer);
+	}
+}
+
+static void wheel_expire(struct neutron_wheel *wheel, int slot)
+{
+	struct neutron_wheel_link list;
+	struct neutron_wheel_link *head = &wheel->slots[0][slot];
+
+	if (link_empty(head))
+		return;
+
+	list = *head;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	link_init(head);
+	wheel->occupied[0] &= ~(1ULL << slot);
+
+	/* callbacks may clear or destroy timers still on the list */
+	while (!link_empty(&list)) {
+		struct neutron_timer *timer = link_to_timer(list.next);
+		wheel_unlink(wheel, timer);
+		neutron_timer_wheel_expired(timer);
+	}
+}
+
+static void wheel_advance(struct neutron_wheel *wheel, uint64_t target)
+{
+	while (wheel->now < target) {
+		uint64_t tick = wheel_next_event(wheel);
+		if (tick > target) {
+			wheel->now = target;
+			break;
+		}
+
+		wheel->now = tick;
+
+		/* highest levels first so cascaded timers land in slots that
+		 * are processed below */
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned shift = level * WHEEL_BITS;
+			if (tick & ((1ULL << shift) - 1))
+				continue;
+			wheel_cascade(
+				wheel, level, (tick >> shift) & WHEEL_MASK);
+		}
+
+		wheel_expire(wheel, tick & WHEEL_MASK);
+	}
+}
+
+static void wheel_fd_cb(int fd, uint32_t revents, void *userdata)
+{
+	struct neutron_wheel *wheel = userdata;
+	uint64_t val;
+	int ret;
+
+	do {
+		ret = read(wheel->tfd, &val, sizeof(val));
+	} while (ret < 0 && errno == EINTR);
+
+	wheel->running = 1;
+	wheel->armed = 0;
+	wheel_advance(wheel, wheel_clock_tick());
+	wheel->running = 0;
+
+	uint64_t next = wheel_next_event(wheel);
+	if (next != UINT64_MAX)
+		wheel_arm(wheel, next);
+}
+
+struct neutron_wheel *neutron_wheel_get(struct neutron_loop *loop)
+{
+	if (loop->wheel)
+		return loop->wheel;
+
+	struct neutron_wheel *wheel = calloc(1, sizeof(struct neutron_wheel));
+	if (!wheel) {
+		LOG_ERRNO("Failure: cannot allocate memory for timing wheel");
+		return NULL;
+	}
+
+	for (int level = 0; level < WHEEL_LEVELS; level++)
+		for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+			link_init(&wheel->slots[level][slot]);
+
+	wheel->loop = loop;
+	wheel->now = wheel_clock_tick();
+	wheel->tfd =
+		timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (wheel->tfd < 0) {
+		LOG_ERRNO("Failed to create timing wheel timer fd");
+		free(wheel);
+		return NULL;
+	}
+
+	int ret = neutron_loop_add(
+		loop, wheel->tfd, wheel_fd_cb, NEUTRON_FD_EVENT_IN, wheel);
+	if (ret) {
+		LOGE("Failed to add timing wheel to loop");
+		close(wheel->tfd);
+		free(wheel);
+		return NULL;
+	}
+
+	loop->wheel = wheel;
+	return wheel;
+}
+
+void neutron_wheel_destroy(struct neutron_wheel *wheel)
+{
+	if (wheel) {
+		if (wheel->tfd >= 0) {
+			neutron_loop_remove(wheel->loop, wheel->tfd);
+			close(wheel->tfd);
+		}
+		wheel->tfd = -1;
+		free(wheel);
+		wheel = NULL;
+	}
+}
+
+void neutron_wheel_add(struct neutron_wheel *wheel,
+		       struct neutron_timer *timer,
+		       uint64_t expiry)
+{
+	if (timer->pending)
+		wheel_unlink(wheel, timer);
+
+	/* an idle wheel may lag far behind, catch up for free */
+	if (wheel->count == 0 && !wheel->running)
+		wheel->now = wheel_clock_tick();
+
+	if (expiry <= wheel->now)
+		expiry = wheel->now + 1;
+
+	timer->expiry = expiry;
+	wheel_place(wheel, timer);
+	timer->pending = 1;
+	wheel->count++;
+
+	/* only a new earliest event needs the timerfd reprogrammed */
+	uint64_t tick = wheel_event_tick(timer);
+	if (!wheel->running && (!wheel->armed || tick < wheel->armed))
+		wheel_arm(wheel, tick);
+}
+
+void neutron_wheel_remove(struct neutron_wheel *wheel,
+			  struct neutron_timer *timer)
+{
+	/* the timerfd stays armed, a spurious wakeup just re-arms it */
+	if (timer->pending)
+		wheel_unlink(wheel, timer);
+}
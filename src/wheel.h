@@ -0,0 +1,48 @@
+#ifndef _WHEEL_H_
+#define _WHEEL_H_
+
+#include <neutron_priv.h>
+#include <neutron.h>
+
+#define WHEEL_TICK_NS 1000000ULL /* 1ms */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS) /* one bit per slot in a uint64_t */
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+#define WHEEL_MAX_TICKS ((1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+struct neutron_wheel_link {
+	struct neutron_wheel_link *prev, *next;
+};
+
+/* Hierarchical timing wheel shared by the wheel timers of a loop. Level L
+ * slots span 64^L ticks; timers cascade down a level when their slot comes
+ * up. A single timerfd is armed for the next tick that has work. */
+struct neutron_wheel {
+	struct neutron_loop *loop;
+
+	int tfd;
+
+	uint64_t now;   /* last processed tick */
+	uint64_t armed; /* tick the timerfd is armed for, 0 when disarmed */
+	int running;    /* expiring timers, arming is deferred */
+
+	uint32_t count;
+	uint64_t occupied[WHEEL_LEVELS];
+	struct neutron_wheel_link slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+uint64_t neutron_wheel_clock_ns(void);
+
+struct neutron_wheel *neutron_wheel_get(struct neutron_loop *loop);
+
+void neutron_wheel_destroy(struct neutron_wheel *wheel);
+
+void neutron_wheel_add(struct neutron_wheel *wheel,
+		       struct neutron_timer *timer,
+		       uint64_t expiry);
+
+void neutron_wheel_remove(struct neutron_wheel *wheel,
+			  struct neutron_timer *timer);
+
+#endif /* _WHEEL_H_ */